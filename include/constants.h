@@ -18,18 +18,79 @@
     #define SERVER_ENDPOINT "http://your.server.endpoint"
 #endif
 
+// Samples carry the time they were taken, set over NTP once WiFi is up
+#ifndef NTP_SERVER
+    #define NTP_SERVER "pool.ntp.org"
+#endif
+#define CLOCK_VALID_AFTER 1700000000 // Unix time, anything earlier means the clock was not set yet
+
+// Uploads - samples are sent together once UPLOAD_BATCH_SIZE are waiting or the oldest is UPLOAD_BATCH_AGE ms old.
+// Batches are posted to /jkbms/ingest/batch as a JSON array, a size of 1 posts each sample to /jkbms/ingest on its own.
+// Keep it at 1 until the server has the batch endpoint
+#define UPLOAD_BATCH_SIZE 1
+#define UPLOAD_BATCH_AGE 15000
+// JSON bodies are rendered this many bytes at a time while they are sent, instead of all at once
+#define UPLOAD_WINDOW_SIZE 256
+// Sample log - batches that could not be uploaded are kept on LittleFS until they can be, with SAMPLE_LOG.
+// At most SAMPLE_LOG_SEGMENTS segment files of about SAMPLE_LOG_SEGMENT_SIZE bytes, the oldest is dropped to make room.
+#define SAMPLE_LOG_SEGMENT_SIZE 16384
+#ifdef ESP32
+    #define SAMPLE_LOG_SEGMENTS 3 // The min_spiffs partition only has 128 KB
+#else
+    #define SAMPLE_LOG_SEGMENTS 16
+#endif
+#define SAMPLE_LOG_RETRY_DELAY 30000 // After a replay did not get through
+
 // Watchdog
 #define WATCHDOG_TIMEOUT 15
 
-// For ESP32 recommended to be about 5 minutes
+// Reboot when BMS sessions have been running this long without any of them ending, recommended to be about 5 minutes
+#define EXECUTION_TIMEOUT 300000
+
+// Adaptive polling - each device's next poll is planned from its last readings
+#define POLL_INTERVAL_ALERT 5000 // Alarm bits set
+#define POLL_INTERVAL_ACTIVE 10000 // High current, or state of charge near either end
+#define POLL_INTERVAL_NORMAL 30000
+#define POLL_INTERVAL_IDLE 120000 // No current to speak of and state of charge unchanged
+#define POLL_ACTIVE_CURRENT 20000 // mA, either direction
+#define POLL_IDLE_CURRENT 1000 // mA, either direction
+#define POLL_LOW_PERCENT 15
+#define POLL_HIGH_PERCENT 95
+// Unreachable devices are retried after the usual interval, doubled for every failure in a row up to the maximum
+#define BACKOFF_MAX_DELAY 900000
+#define BACKOFF_JITTER_PERCENT 20
+// Session time all devices together may spend per window, once used up no new polls start until the next window
+#define RADIO_BUDGET_WINDOW 60000
+#define RADIO_BUDGET 30000
+
+// Number of BMS devices serviced at the same time, 1 polls them one by one
+// On ESP32 limited by NIMBLE_MAX_CONNECTIONS, on RP2040 by MAX_NR_HCI_CONNECTIONS in the BTstack config
 #ifdef ESP32
-    #define EXECUTION_TIMEOUT 300000
+    #define MAX_CONCURRENT_BMS 3
 #endif
-// For RP2040 recommended to be about 30 seconds
 #ifdef ARDUINO_ARCH_RP2040
-    #define EXECUTION_TIMEOUT 30000
+    #define MAX_CONCURRENT_BMS 1
 #endif
 
+// ESP32 tasks - acquisition, upload and UI run apart, with parsed samples queued between acquisition and upload
+#ifdef ESP32
+    #define SAMPLE_QUEUE_LENGTH 8
+    #define TASK_STACK_SIZE 8192
+    // Application core, with the Arduino loop - the NimBLE host and WiFi run on core 0
+    #define ACQUISITION_TASK_CORE 1
+    #define ACQUISITION_TASK_PRIORITY 3
+    #define UPLOAD_TASK_CORE 0
+    #define UPLOAD_TASK_PRIORITY 1
+    #define UI_TASK_CORE 1
+    #define UI_TASK_PRIORITY 1
+    #define PIPELINE_REPORT_INTERVAL 60000
+#endif
+
+// Battery info (serial number, versions) is reused for this many sessions before it is requested again, 0 to always request it
+#define BATTERY_INFO_REFRESH_SESSIONS 100
+// Session counts are written to config.dat every this many sessions instead of after each one
+#define BATTERY_INFO_SAVE_SESSIONS 10
+
 // Touchscreen
 #define XPT2046_IRQ 36
 #define XPT2046_MOSI 32
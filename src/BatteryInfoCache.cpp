@@ -0,0 +1,85 @@
+#include "BatteryInfoCache.h"
+
+#ifdef PERSIST_BATTERY_INFO
+#include "Config.h"
+#endif
+
+BatteryInfoCache& BatteryInfoCache::getInstance() {
+    static BatteryInfoCache instance;
+    return instance;
+}
+
+const unsigned char* BatteryInfoCache::beginSession(const uint8_t* address) {
+    StoredBatteryInfo* entry = find(address);
+    if (!entry) {
+        return nullptr;
+    }
+
+    if (entry->sessionsSinceRefresh >= BATTERY_INFO_REFRESH_SESSIONS) {
+        return nullptr;
+    }
+
+    // Only every BATTERY_INFO_SAVE_SESSIONS reaches flash, a reboot loses at most that many counts
+    entry->sessionsSinceRefresh++;
+    if (entry->sessionsSinceRefresh % BATTERY_INFO_SAVE_SESSIONS == 0) {
+        save();
+    }
+    return entry->record;
+}
+
+void BatteryInfoCache::store(const uint8_t* address, const unsigned char* record) {
+    StoredBatteryInfo* entry = find(address);
+
+    for (size_t i = 0; i < MAX_SCAN_DEVICES && !entry; i++) {
+        if (!entries[i].valid) {
+            entry = &entries[i];
+        }
+    }
+
+    if (!entry) {
+        entry = &entries[nextEntry];
+        nextEntry = (nextEntry + 1) % MAX_SCAN_DEVICES;
+    }
+
+    bool changed = !entry->valid || entry->sessionsSinceRefresh != 0 || memcmp(entry->record, record, RECORD_LENGTH) != 0;
+
+    memcpy(entry->address, address, sizeof(entry->address));
+    memcpy(entry->record, record, RECORD_LENGTH);
+    entry->valid = 1;
+    entry->sessionsSinceRefresh = 0;
+
+    if (changed) {
+        save();
+    }
+}
+
+StoredBatteryInfo* BatteryInfoCache::find(const uint8_t* address) {
+    load();
+
+    for (size_t i = 0; i < MAX_SCAN_DEVICES; i++) {
+        if (entries[i].valid && memcmp(entries[i].address, address, sizeof(entries[i].address)) == 0) {
+            return &entries[i];
+        }
+    }
+
+    return nullptr;
+}
+
+void BatteryInfoCache::load() {
+    if (entries) {
+        return;
+    }
+
+#ifdef PERSIST_BATTERY_INFO
+    entries = Config::getInstance().batteryInfo;
+#else
+    static StoredBatteryInfo ramEntries[MAX_SCAN_DEVICES] = {};
+    entries = ramEntries;
+#endif
+}
+
+void BatteryInfoCache::save() {
+#ifdef PERSIST_BATTERY_INFO
+    Config::save();
+#endif
+}
\ No newline at end of file
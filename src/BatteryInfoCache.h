@@ -0,0 +1,28 @@
+#ifndef BATTERY_INFO_CACHE_H
+#define BATTERY_INFO_CACHE_H
+
+#include "constants.h"
+#include "models/constants.h"
+#include "models/battery_info.h"
+
+// Battery info records per BMS address - model, versions and serial number practically never change,
+// so sessions only ask for them every BATTERY_INFO_REFRESH_SESSIONS. Kept in RAM, and in Config on LittleFS
+// when built with PERSIST_BATTERY_INFO.
+class BatteryInfoCache {
+public:
+    static BatteryInfoCache& getInstance();
+
+    // Counts a session for the device, returns its record or nullptr if there is none or it is due for a refresh
+    const unsigned char* beginSession(const uint8_t* address);
+    void store(const uint8_t* address, const unsigned char* record);
+private:
+    // With PERSIST_BATTERY_INFO these live in Config, so the session counts are saved along with it
+    StoredBatteryInfo* entries = nullptr;
+    size_t nextEntry = 0; // Replaced next when the cache is full
+
+    StoredBatteryInfo* find(const uint8_t* address);
+    void load();
+    void save();
+};
+
+#endif // BATTERY_INFO_CACHE_H
\ No newline at end of file
@@ -1,9 +1,153 @@
 #include "ChartClient.h"
 
+#include <algorithm>
+
+WindowPrint::WindowPrint(uint8_t* buffer, size_t capacity, size_t start) : buffer(buffer), capacity(capacity), start(start) {}
+
+size_t WindowPrint::write(uint8_t value) {
+    return write(&value, 1);
+}
+
+size_t WindowPrint::write(const uint8_t* data, size_t size) {
+    // Copy only the part of this write that lands inside the window
+    size_t from = start + used;
+    size_t end = printed + size;
+    if (used < capacity && end > from) {
+        size_t skip = from > printed ? from - printed : 0;
+        size_t copy = std::min(size - skip, capacity - used);
+        memcpy(buffer + used, data + skip, copy);
+        used += copy;
+    }
+
+    printed = end;
+    return size; // Everything counts as written, or Print would stop early
+}
+
+size_t WindowPrint::length() const {
+    return used;
+}
+
+size_t WindowPrint::total() const {
+    return printed;
+}
+
+SampleJsonStream::SampleJsonStream(const BMSSample* samples, size_t count) : samples(samples), count(count) {
+    for (size_t i = 0; i < count; i++) {
+        WindowPrint counter(nullptr, 0, 0);
+        printPiece(counter, i);
+        pieceLengths[i] = counter.total();
+        length += pieceLengths[i];
+    }
+}
+
+size_t SampleJsonStream::size() const {
+    return length;
+}
+
+void SampleJsonStream::rewind() {
+    position = 0;
+    windowLength = 0;
+}
+
+void SampleJsonStream::printTo(Print& out) const {
+    for (size_t i = 0; i < count; i++) {
+        printPiece(out, i);
+    }
+}
+
+int SampleJsonStream::available() {
+    return length - position;
+}
+
+int SampleJsonStream::read() {
+    int value = peek();
+    if (value >= 0) {
+        position++;
+    }
+    return value;
+}
+
+int SampleJsonStream::peek() {
+    if (position >= length) {
+        return -1;
+    }
+
+    if (position - windowStart >= windowLength) {
+        fill();
+    }
+
+    return window[position - windowStart];
+}
+
+size_t SampleJsonStream::readBytes(char* output, size_t outputLength) {
+    size_t copied = 0;
+    while (copied < outputLength && position < length) {
+        if (position - windowStart >= windowLength) {
+            fill();
+        }
+
+        size_t chunk = std::min(outputLength - copied, windowStart + windowLength - position);
+        memcpy(output + copied, window + (position - windowStart), chunk);
+        copied += chunk;
+        position += chunk;
+    }
+    return copied;
+}
+
+size_t SampleJsonStream::write(uint8_t value) {
+    return 0; // Read only
+}
+
+void SampleJsonStream::printPiece(Print& out, size_t index) const {
+    // A batch size of 1 posts a bare object
+    if (UPLOAD_BATCH_SIZE > 1) {
+        out.print(index == 0 ? "[" : ",");
+    }
+
+    printSample(out, samples[index]);
+
+    if (UPLOAD_BATCH_SIZE > 1 && index == count - 1) {
+        out.print("]");
+    }
+}
+
+void SampleJsonStream::printSample(Print& out, const BMSSample& sample) {
+    out.print("{\"serial_number\":\"");
+    out.print(sample.serialNumber);
+    out.print("\"");
+    // Left out when the clock was not set, the server then goes by when the sample arrives
+    if (sample.capturedAt != 0) {
+        out.print(",\"captured_at\":");
+        print_fixed(out, sample.capturedAt, false, 0);
+    }
+    out.print(",\"cell_info\":");
+    sample.cellInfo.printJson(out);
+    out.print("}");
+}
+
+void SampleJsonStream::fill() {
+    size_t index = 0;
+    size_t pieceStart = 0;
+    while (index < count && pieceStart + pieceLengths[index] <= position) {
+        pieceStart += pieceLengths[index++];
+    }
+
+    WindowPrint out(window, sizeof(window), position - pieceStart);
+    for (; index < count && out.length() < sizeof(window); index++) {
+        printPiece(out, index);
+    }
+
+    windowStart = position;
+    windowLength = out.length();
+}
+
 void ChartClient::init() {
     WiFi.mode(WIFI_STA);
     WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
     Serial.printf("Connecting to WiFi network: %s\n", WIFI_SSID);
+
+    // Keep the connection to the server open between uploads
+    http.setReuse(true);
 }
 
 void ChartClient::monitor() {
@@ -12,151 +156,261 @@ void ChartClient::monitor() {
             isConnected = true;
             Serial.println("WiFi connected");
             Serial.printf("IP address: %s\n", WiFi.localIP().toString().c_str());
+
+            // Keeps the clock in sync from here on, so samples taken without WiFi still get their time
+            if (!clockStarted) {
+                clockStarted = true;
+#ifdef ARDUINO_ARCH_RP2040
+                NTP.begin(NTP_SERVER);
+#else
+                configTime(0, 0, NTP_SERVER);
+#endif
+            }
         }
     } else {
         if (isConnected) {
             isConnected = false;
             Serial.printf("WiFi disconnected\n");
+            client.stop(); // The kept-alive connection did not survive that
         }
     }
-}
 
-void ChartClient::sendData(const JKBMSNotificationBuffer& data) {
-    if (!isConnected) {
-        Serial.println("Cannot send data: not connected to WiFi");
-        return;
+    if (batchCount > 0 && millis() - batchStarted >= UPLOAD_BATCH_AGE) {
+        flush();
     }
 
-    const BatteryInfo* batteryInfo = data.getBatteryInfo();
-    const CellInfo* cellInfo = data.getCellInfo();
+#ifdef SAMPLE_LOG
+    // One stored batch per call, so the loop keeps running while a backlog drains
+    if (isConnected && batchCount == 0 && (long) (millis() - nextReplay) >= 0) {
+        replay();
+    }
+#endif
+}
+
+bool ChartClient::isReady() const {
+    return isConnected;
+}
+
+bool ChartClient::makeSample(const JKBMSNotificationBuffer& data, BMSSample& sample) {
+    // Only the serial number is needed from the battery info, so read it straight from a copy of the frame
+    unsigned char batteryRecord[RECORD_LENGTH];
+    BatteryFrame batteryFrame = data.snapshotBatteryFrame(batteryRecord);
 
-    if (!batteryInfo || !cellInfo) {
+    if (!batteryFrame.isValid() || !data.snapshotCellInfo(sample.cellInfo)) {
         Serial.println("Cannot send data: incomplete information");
-        return;
+        return false;
     }
 
+    char serialNumber[12];
+    batteryFrame.getSerialNumber(serialNumber);
+
     if (
-        strlen(batteryInfo->serialNumber) == 0 || // varchar(12)
-        strlen(batteryInfo->serialNumber) > 12 ||
-        cellInfo->average_cell_voltage < 0.0f || cellInfo->average_cell_voltage > 5.000f || // decimal(5, 3)
-        cellInfo->delta_cell_voltage < 0.0f || cellInfo->delta_cell_voltage > 5.000f || // decimal(5, 3)
-        cellInfo->mosfet_temperature < -40.0f || cellInfo->mosfet_temperature > 99.999f || // decimal(5, 3)
-        cellInfo->battery_voltage < 0.0f || cellInfo->battery_voltage > 99.999f || // decimal(5, 3)
-        cellInfo->battery_power < 0.0f || cellInfo->battery_power > 99.999f || // decimal(5, 3)
-        fabs(cellInfo->battery_current) > 99.999f || // decimal(5, 3) - can be negative
-        cellInfo->battery_temperature_1 < -9999.9f || cellInfo->battery_temperature_1 > 9999.9f || // decimal(5, 1)
-        cellInfo->battery_temperature_2 < -9999.9f || cellInfo->battery_temperature_2 > 9999.9f || // decimal(5, 1)
-        cellInfo->alarm_bits > 0xFFFFFFFF || // bigint (unsigned 32-bit)
-        cellInfo->percent_remaining > 100 || // tinyint (0-100)
-        cellInfo->remaining_capacity < 0.0f || cellInfo->remaining_capacity > 9999999.999f || // decimal(10, 3)
-        cellInfo->nominal_capacity < 0.0f || cellInfo->nominal_capacity > 9999999.999f || // decimal(10, 3)
-        cellInfo->cycle_capacity < 0.0f || cellInfo->cycle_capacity > 9999999.999f || // decimal(10, 3)
-        cellInfo->state_of_health > 100 || // tinyint (0-100)
-        cellInfo->cycle_count > 0xFFFFFFFF // bigint (unsigned 32-bit)
+        strlen(serialNumber) == 0 || // varchar(12)
+        strlen(serialNumber) > 12 ||
+        !sample.cellInfo.in_range
     ) {
         Serial.println("Cannot send data: data is corrupted");
+        return false;
+    }
+
+    strcpy(sample.serialNumber, serialNumber);
+    sample.capturedAt = captureTime();
+    return true;
+}
+
+uint32_t ChartClient::captureTime() {
+    time_t now = time(nullptr);
+    return now >= CLOCK_VALID_AFTER ? static_cast<uint32_t>(now) : 0;
+}
+
+void ChartClient::addSample(const BMSSample& sample) {
+    if (batchCount == 0) {
+        batchStarted = millis();
+    }
+
+    // A batch kept after a failed post makes room for the newest sample by dropping its oldest
+    if (batchCount >= UPLOAD_BATCH_SIZE) {
+        memmove(batch, batch + 1, (UPLOAD_BATCH_SIZE - 1) * sizeof(batch[0]));
+        batchCount--;
+    }
+
+    batch[batchCount++] = sample;
+
+    if (batchCount >= UPLOAD_BATCH_SIZE) {
+        flush();
+    }
+}
+
+bool ChartClient::flush() {
+    if (batchCount == 0) {
+        return true;
+    }
+
+    int httpResponseCode = upload(batch, batchCount);
+    if (isDelivered(httpResponseCode)) {
+        sentCount += batchCount;
+        batchCount = 0;
+        return true;
+    }
+
+    failedCount += batchCount;
+    if (isRefused(httpResponseCode)) {
+        Serial.printf("Server refused %zu samples, dropping them\n", batchCount);
+        batchCount = 0;
+        return false;
+    }
+
+#ifdef SAMPLE_LOG
+    // Sent again from monitor() once the server can be reached
+    if (SampleLog::getInstance().append(batch, batchCount)) {
+        batchCount = 0;
+        return false;
+    }
+#endif
+
+    // Kept for another try once the batch is due again
+    batchStarted = millis();
+    return false;
+}
+
+#ifdef SAMPLE_LOG
+void ChartClient::replay() {
+    SampleLog& log = SampleLog::getInstance();
+    if (log.isEmpty()) {
         return;
     }
 
-    Serial.println("Sending data to server...");
-    // JSON - sprintf force all floats to be two decimal places (since that's our actual precision)
+    // The batch is empty, so its room is free for the stored samples
+    size_t count = log.peek(batch, UPLOAD_BATCH_SIZE);
+    if (count > 0) {
+        Serial.printf("Replaying %zu stored samples...\n", count);
 
-    const char* jsonTemplate = R"({
-        "serial_number": "%s",
-        "cell_info": {
-            "cell_voltages": [
-                %.2f, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f,
-                %.2f, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f
-            ],
-            "average_cell_voltage": %.2f,
-            "delta_cell_voltage": %.2f,
-            "cell_wire_resistances": [
-                %.2f, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f,
-                %.2f, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f
-            ],
-            "mosfet_temperature": %.2f,
-            "battery_voltage": %.2f,
-            "battery_power": %.2f,
-            "battery_current": %.2f,
-            "battery_temperature_1": %.2f,
-            "battery_temperature_2": %.2f,
-            "alarm_bits": %u,
-            "percent_remaining": %u,
-            "remaining_capacity": %.2f,
-            "nominal_capacity": %.2f,
-            "cycle_capacity": %.2f,
-            "state_of_health": %u,
-            "cycle_count": %u
+        int httpResponseCode = upload(batch, count);
+        if (isRefused(httpResponseCode)) {
+            Serial.printf("Server refused %zu stored samples, dropping them\n", count);
+            failedCount += count;
+        } else if (!isDelivered(httpResponseCode)) {
+            nextReplay = millis() + SAMPLE_LOG_RETRY_DELAY;
+            return;
+        } else {
+            sentCount += count;
         }
-    })";
+    }
+
+    log.consume();
+}
+#endif
+
+int ChartClient::upload(const BMSSample* samples, size_t count) {
+    if (!isConnected) {
+        Serial.println("Cannot send data: not connected to WiFi");
+        return 0;
+    }
+
+    Serial.printf("Sending %zu samples to server...\n", count);
+
+#ifdef TELEMETRY_BINARY
+    size_t length = 0;
+    if (!encodeTelemetry(samples, count, buffer, sizeof(buffer), length)) {
+        Serial.println("Cannot send data: payload does not fit in buffer");
+        return 0;
+    }
+
+    return post(SERVER_ENDPOINT "/jkbms/ingest/binary", "application/octet-stream", buffer, length);
+#else
+    SampleJsonStream body(samples, count);
+#ifdef JKBMS_DEBUG
+    Serial.print("Payload: ");
+    body.printTo(Serial);
+    Serial.println();
+#endif
+
+    return post(UPLOAD_BATCH_SIZE == 1 ? SERVER_ENDPOINT "/jkbms/ingest" : SERVER_ENDPOINT "/jkbms/ingest/batch", "application/json", body);
+#endif
+}
+
+bool ChartClient::isDelivered(int httpResponseCode) {
+    return httpResponseCode >= 200 && httpResponseCode < 300;
+}
+
+bool ChartClient::isRefused(int httpResponseCode) {
+    // Only a request the server read and rejected - a 404, 408 or 429 may well go through later, like a 5xx or no answer
+    return httpResponseCode == 400 || httpResponseCode == 422;
+}
+
+int ChartClient::post(const char* url, const char* contentType, const uint8_t* payload, size_t length) {
+    return send(url, contentType, payload, nullptr, length);
+}
+
+int ChartClient::post(const char* url, const char* contentType, SampleJsonStream& body) {
+    return send(url, contentType, nullptr, &body, body.size());
+}
+
+int ChartClient::send(const char* url, const char* contentType, const uint8_t* payload, SampleJsonStream* body, size_t length) {
+    Serial.printf("POST %s\n", url);
+    Serial.printf("Content-Length: %zu\n", length);
+
+    int httpResponseCode = 0;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool reused = client.connected();
+
+        // With reuse on, begin() and end() keep the socket - only the request state is rebuilt
+        http.begin(client, url);
+        http.addHeader("Content-Type", contentType);
+        if (body) {
+            // Sent with a Content-Length, read from the stream a buffer at a time
+            body->rewind();
+            httpResponseCode = http.sendRequest("POST", body, length);
+        } else {
+            httpResponseCode = http.POST((uint8_t*) payload, length);
+        }
+        http.end();
+
+        // Only failures before the body went out - once it has, the server may have stored the samples and a resend
+        // would duplicate them, so a lost connection or a missing answer is left to the caller
+        bool stale = reused && (
+            httpResponseCode == HTTPC_ERROR_SEND_HEADER_FAILED ||
+            httpResponseCode == HTTPC_ERROR_NOT_CONNECTED ||
+            httpResponseCode == HTTPC_ERROR_CONNECTION_REFUSED
+        );
+
+        if (!stale) {
+            break;
+        }
+
+        // The server closed the idle connection before the request reached it, so it is safe to send again
+        Serial.println("Kept-alive connection went stale, reconnecting...");
+        client.stop();
+    }
 
-    size_t len = sprintf(buffer, jsonTemplate,
-        batteryInfo->serialNumber,
-        cellInfo->cell_voltages[0],
-        cellInfo->cell_voltages[1],
-        cellInfo->cell_voltages[2],
-        cellInfo->cell_voltages[3],
-        cellInfo->cell_voltages[4],
-        cellInfo->cell_voltages[5],
-        cellInfo->cell_voltages[6],
-        cellInfo->cell_voltages[7],
-        cellInfo->cell_voltages[8],
-        cellInfo->cell_voltages[9],
-        cellInfo->cell_voltages[10],
-        cellInfo->cell_voltages[11],
-        cellInfo->cell_voltages[12],
-        cellInfo->cell_voltages[13],
-        cellInfo->cell_voltages[14],
-        cellInfo->cell_voltages[15],
-        cellInfo->average_cell_voltage,
-        cellInfo->delta_cell_voltage,
-        cellInfo->cell_wire_resistances[0],
-        cellInfo->cell_wire_resistances[1],
-        cellInfo->cell_wire_resistances[2],
-        cellInfo->cell_wire_resistances[3],
-        cellInfo->cell_wire_resistances[4],
-        cellInfo->cell_wire_resistances[5],
-        cellInfo->cell_wire_resistances[6],
-        cellInfo->cell_wire_resistances[7],
-        cellInfo->cell_wire_resistances[8],
-        cellInfo->cell_wire_resistances[9],
-        cellInfo->cell_wire_resistances[10],
-        cellInfo->cell_wire_resistances[11],
-        cellInfo->cell_wire_resistances[12],
-        cellInfo->cell_wire_resistances[13],
-        cellInfo->cell_wire_resistances[14],
-        cellInfo->cell_wire_resistances[15],
-        cellInfo->mosfet_temperature,
-        cellInfo->battery_voltage,
-        cellInfo->battery_power,
-        cellInfo->battery_current,
-        cellInfo->battery_temperature_1,
-        cellInfo->battery_temperature_2,
-        cellInfo->alarm_bits,
-        cellInfo->percent_remaining,
-        cellInfo->remaining_capacity,
-        cellInfo->nominal_capacity,
-        cellInfo->cycle_capacity,
-        cellInfo->state_of_health,
-        cellInfo->cycle_count
-    );
-
-    http.begin(client, SERVER_ENDPOINT "/jkbms/ingest");
-    Serial.printf("POST %s\n", SERVER_ENDPOINT "/jkbms/ingest");
-    Serial.printf("Payload: %s\n", buffer);
-
-    http.addHeader("Content-Type", "application/json");
-    Serial.printf("Content-Length: %zu\n", len);
-
-    delay(100); // Small delay to allow connection to stabilize
-    int httpResponseCode = http.POST((uint8_t*) buffer, len);
     if (httpResponseCode > 0) {
         Serial.printf("HTTP Response code: %d\n", httpResponseCode);
     } else {
         Serial.printf("HTTP POST failed: %s\n", http.errorToString(httpResponseCode).c_str());
+        client.stop(); // Start over with a fresh connection next time
     }
 
-    http.end();
+    return httpResponseCode;
+}
+
+void ChartClient::sendData(const JKBMSNotificationBuffer& data) {
+    if (!isConnected) {
+        Serial.println("Cannot send data: not connected to WiFi");
+        return;
+    }
+
+    BMSSample sample;
+    if (makeSample(data, sample)) {
+        addSample(sample);
+    }
+}
+
+uint32_t ChartClient::getSentCount() const {
+    return sentCount;
+}
+
+uint32_t ChartClient::getFailedCount() const {
+    return failedCount;
 }
 
 void ChartClient::sendTestData() {
@@ -224,20 +478,6 @@ void ChartClient::sendTestData() {
         }
     })";
 
-    http.begin(client, SERVER_ENDPOINT "/jkbms/ingest");
-    Serial.printf("POST %s\n", SERVER_ENDPOINT "/jkbms/ingest");
     Serial.printf("Payload: %s\n", testData);
-
-    http.addHeader("Content-Type", "application/json");
-    Serial.printf("Content-Length: %zu\n", strlen(testData));
-
-    delay(100); // Small delay to allow connection to stabilize
-    int httpResponseCode = http.POST((uint8_t*) testData, strlen(testData));
-    if (httpResponseCode > 0) {
-        Serial.printf("HTTP Response code: %d\n", httpResponseCode);
-    } else {
-        Serial.printf("HTTP POST failed: %s\n", http.errorToString(httpResponseCode).c_str());
-    }
-
-    http.end();
+    post(SERVER_ENDPOINT "/jkbms/ingest", "application/json", (const uint8_t*) testData, strlen(testData));
 }
@@ -3,23 +3,121 @@
 
 #include "constants.h"
 #include "JKBMSNotificationBuffer.h"
+#include "models/sample.h"
+#include "models/telemetry.h"
+#ifdef SAMPLE_LOG
+#include "SampleLog.h"
+#endif
 
+#include <atomic>
+#include <time.h>
 #include <Arduino.h>
 #include <WiFi.h>
 #include <HTTPClient.h>
 
+// Keeps the bytes from start up to start + capacity of whatever is printed, counting all of them
+class WindowPrint : public Print {
+public:
+    WindowPrint(uint8_t* buffer, size_t capacity, size_t start);
+
+    size_t write(uint8_t value) override;
+    size_t write(const uint8_t* data, size_t size) override;
+    size_t length() const; // Bytes kept
+    size_t total() const; // Bytes printed
+private:
+    uint8_t* buffer;
+    size_t capacity;
+    size_t start;
+    size_t used = 0;
+    size_t printed = 0;
+};
+
+// The JSON body of a batch, rendered a window at a time as HTTPClient reads it, so the whole body is never held.
+// Its length is counted up front for Content-Length - the samples must not change while it is in use.
+class SampleJsonStream : public Stream {
+public:
+    SampleJsonStream(const BMSSample* samples, size_t count);
+
+    size_t size() const;
+    // Back to the start, to send the body again
+    void rewind();
+    // The whole body, e.g. to Serial
+    void printTo(Print& out) const;
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t readBytes(char* output, size_t length) override;
+    size_t write(uint8_t value) override;
+private:
+    const BMSSample* samples;
+    size_t count;
+    size_t pieceLengths[UPLOAD_BATCH_SIZE]; // Each sample with its separator
+    size_t length = 0;
+    size_t position = 0; // Next byte of the body to be read
+
+    uint8_t window[UPLOAD_WINDOW_SIZE];
+    size_t windowStart = 0;
+    size_t windowLength = 0;
+
+    void printPiece(Print& out, size_t index) const;
+    static void printSample(Print& out, const BMSSample& sample);
+    // Renders the window starting at position, skipping every sample that ends before it
+    void fill();
+};
+
 class ChartClient {
 public:
     void init();
     void monitor();
+    bool isReady() const;
+
+    // Takes a consistent copy of the latest readings - false if they are incomplete or out of range
+    static bool makeSample(const JKBMSNotificationBuffer& data, BMSSample& sample);
+    // Adds the sample to the batch, sending the batch once it is full - monitor() sends it once it is too old
+    void addSample(const BMSSample& sample);
+    // Sends whatever is batched, blocking until the server answers or the request times out. A batch the server refuses
+    // is dropped. One that does not get through, or is flushed without WiFi, is kept and sent again once it is due -
+    // with SAMPLE_LOG it is stored and monitor() replays it once the server can be reached.
+    bool flush();
     void sendData(const JKBMSNotificationBuffer& data);
     void sendTestData();
+
+    // Samples, safe from any task
+    uint32_t getSentCount() const;
+    uint32_t getFailedCount() const;
 private:
     bool isConnected = false;
+    bool clockStarted = false;
+    std::atomic<uint32_t> sentCount { 0 };
+    std::atomic<uint32_t> failedCount { 0 };
     WiFiClient client;
     HTTPClient http;
 
-    char buffer[2048];
+    BMSSample batch[UPLOAD_BATCH_SIZE];
+    size_t batchCount = 0;
+    unsigned long batchStarted = 0; // When the oldest batched sample was added, or the last post of the batch failed
+
+#ifdef SAMPLE_LOG
+    unsigned long nextReplay = 0; // Held off for a while after a replay did not get through
+    void replay();
+#endif
+
+#ifdef TELEMETRY_BINARY
+    uint8_t buffer[TELEMETRY_HEADER_LENGTH + UPLOAD_BATCH_SIZE * TELEMETRY_SAMPLE_MAX_LENGTH];
+#endif
+
+    // The time now for a sample, 0 until NTP has set the clock
+    static uint32_t captureTime();
+    // Returns the HTTP response code, or 0 if nothing was sent
+    int upload(const BMSSample* samples, size_t count);
+    static bool isDelivered(int httpResponseCode);
+    // Samples the server will never take, dropped instead of being sent again
+    static bool isRefused(int httpResponseCode);
+    // Over the kept-alive connection, reconnecting once if it turns out to have gone stale - a streamed body is rewound for that
+    int post(const char* url, const char* contentType, const uint8_t* payload, size_t length);
+    int post(const char* url, const char* contentType, SampleJsonStream& body);
+    int send(const char* url, const char* contentType, const uint8_t* payload, SampleJsonStream* body, size_t length);
 };
 
 #endif
\ No newline at end of file
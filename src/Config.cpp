@@ -1,5 +1,18 @@
 #include "Config.h"
 
+// config.dat starts with this header, anything that does not match it is replaced by defaults.
+// Bump CONFIG_VERSION whenever the layout of Config changes without changing its size.
+#define CONFIG_MAGIC 0x464B4A43 // "CJKF"
+#define CONFIG_VERSION 1
+
+struct ConfigHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+};
+
+static_assert(sizeof(Config) <= UINT16_MAX, "Config no longer fits the size in its header");
+
 Config Config::instance;
 bool Config::initialized = false;
 
@@ -14,6 +27,8 @@ Config& Config::getInstance() {
 void Config::save() {
     File configFile = LittleFS.open("/config.dat", "w");
     if (configFile) {
+        ConfigHeader header = { CONFIG_MAGIC, CONFIG_VERSION, sizeof(instance) };
+        configFile.write((const uint8_t *) &header, sizeof(header));
         configFile.write((const uint8_t *) &instance, sizeof(instance));
         configFile.close();
     } else {
@@ -34,15 +49,21 @@ void Config::init() {
     if (LittleFS.exists("/config.dat")) {
         File configFile = LittleFS.open("/config.dat", "r");
         if (configFile) {
-            // Read the configuration data
-            configFile.readBytes((char *) &instance, sizeof(instance));
+            // Only take data written with the same layout, older firmware may have stored something else
+            ConfigHeader header = {};
+            readOK = configFile.readBytes((char *) &header, sizeof(header)) == sizeof(header) &&
+                header.magic == CONFIG_MAGIC &&
+                header.version == CONFIG_VERSION &&
+                header.size == sizeof(instance) &&
+                configFile.readBytes((char *) &instance, sizeof(instance)) == sizeof(instance);
             configFile.close();
-            readOK = true;
         }
     }
 
     if (!readOK) {
         // If reading failed, initialize default values
+        Serial.println("No valid config found, using defaults");
+        instance = Config();
         save();
     }
 
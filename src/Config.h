@@ -4,12 +4,19 @@
 #include <Arduino.h>
 #include <LittleFS.h>
 
+#include "models/constants.h"
+#include "models/gatt_handles.h"
+#include "models/battery_info.h"
+
 class Config {
 public:
     static Config& getInstance();
     static void save();
 
-    uint8_t lastBMSChecked = 0;
+    GattHandles gattHandles[MAX_SCAN_DEVICES] = {}; // Only used with PERSIST_GATT_CACHE
+#ifdef PERSIST_BATTERY_INFO
+    StoredBatteryInfo batteryInfo[MAX_SCAN_DEVICES] = {};
+#endif
 private:
     static Config instance;
     static bool initialized;
@@ -0,0 +1,57 @@
+#include "DeviceHealth.h"
+
+void DeviceHealth::recordSuccess(int device) {
+    DeviceHealthStats& stats = devices[device];
+    stats.consecutiveFailures = 0;
+    stats.successes++;
+    stats.lastSuccess = millis();
+}
+
+void DeviceHealth::recordFailure(int device, JKBMSFailure reason) {
+    DeviceHealthStats& stats = devices[device];
+    if (stats.consecutiveFailures < UINT16_MAX) {
+        stats.consecutiveFailures++;
+    }
+
+    stats.failures++;
+    stats.lastFailure = reason;
+    // Devices that drop out together, e.g. on a power cut, should not keep retrying in lockstep
+    stats.jitterPercent = random(-BACKOFF_JITTER_PERCENT, BACKOFF_JITTER_PERCENT + 1);
+}
+
+unsigned long DeviceHealth::getRetryDelay(int device, unsigned long baseDelay) const {
+    const DeviceHealthStats& stats = devices[device];
+    if (stats.consecutiveFailures == 0) {
+        return baseDelay;
+    }
+
+    unsigned long delay = baseDelay;
+    for (uint16_t i = 1; i < stats.consecutiveFailures && delay < BACKOFF_MAX_DELAY; i++) {
+        delay *= 2;
+    }
+
+    if (delay > BACKOFF_MAX_DELAY) {
+        delay = BACKOFF_MAX_DELAY;
+    }
+
+    return delay + (long) delay * stats.jitterPercent / 100;
+}
+
+const DeviceHealthStats& DeviceHealth::getStats(int device) const {
+    return devices[device];
+}
+
+void DeviceHealth::print(int device) const {
+    const DeviceHealthStats& stats = devices[device];
+
+    Serial.printf("BMS device %d health: %u ok, %u failed, %u failed in a row", device + 1, stats.successes, stats.failures, stats.consecutiveFailures);
+    if (stats.consecutiveFailures) {
+        Serial.printf(" (%s)", getFailureName(stats.lastFailure));
+    }
+
+    if (stats.lastSuccess) {
+        Serial.printf(", last success %lu s ago\n", (millis() - stats.lastSuccess) / 1000);
+    } else {
+        Serial.println(", never succeeded");
+    }
+}
\ No newline at end of file
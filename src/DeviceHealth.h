@@ -0,0 +1,32 @@
+#ifndef DEVICE_HEALTH_H
+#define DEVICE_HEALTH_H
+
+#include "constants.h"
+#include "models/constants.h"
+#include "JKBMSSession.h"
+
+struct DeviceHealthStats {
+    uint16_t consecutiveFailures = 0;
+    uint32_t successes = 0;
+    uint32_t failures = 0;
+    unsigned long lastSuccess = 0; // millis(), 0 if never
+    JKBMSFailure lastFailure = FAILURE_NONE;
+    int8_t jitterPercent = 0; // Picked on each failure, so the retry delay stays put until the next one
+};
+
+// Session outcomes per BMS, and how long to stay away from one that keeps failing - the delay doubles
+// with every failure in a row up to BACKOFF_MAX_DELAY, spread by BACKOFF_JITTER_PERCENT either way
+class DeviceHealth {
+public:
+    void recordSuccess(int device);
+    void recordFailure(int device, JKBMSFailure reason);
+
+    // baseDelay while the device is healthy
+    unsigned long getRetryDelay(int device, unsigned long baseDelay) const;
+    const DeviceHealthStats& getStats(int device) const;
+    void print(int device) const;
+private:
+    DeviceHealthStats devices[MAX_SCAN_DEVICES];
+};
+
+#endif // DEVICE_HEALTH_H
\ No newline at end of file
@@ -0,0 +1,44 @@
+#include "FrameSnapshot.h"
+
+// A reader only retries when a publish lands mid-copy - new frames arrive about once a second
+#define SNAPSHOT_READ_ATTEMPTS 8
+
+void FrameSnapshot::publish(const unsigned char* record, size_t length) {
+    uint32_t start = sequence.load(std::memory_order_relaxed);
+    sequence.store(start + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(frame, record, length);
+
+    sequence.store(start + 2, std::memory_order_release);
+}
+
+uint32_t FrameSnapshot::read(unsigned char* output) const {
+    for (int attempt = 0; attempt < SNAPSHOT_READ_ATTEMPTS; ++attempt) {
+        uint32_t before = sequence.load(std::memory_order_acquire);
+        if (before == 0) {
+            return 0;
+        }
+
+        if (before & 1) {
+            continue;
+        }
+
+        memcpy(output, frame, RECORD_LENGTH);
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (sequence.load(std::memory_order_relaxed) == before) {
+            return before / 2;
+        }
+    }
+
+    return 0;
+}
+
+uint32_t FrameSnapshot::getVersion() const {
+    return sequence.load(std::memory_order_acquire) / 2;
+}
+
+const unsigned char* FrameSnapshot::data() const {
+    return frame;
+}
\ No newline at end of file
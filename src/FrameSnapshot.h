@@ -0,0 +1,28 @@
+#ifndef FRAME_SNAPSHOT_H
+#define FRAME_SNAPSHOT_H
+
+#include "models/constants.h"
+
+#include <atomic>
+
+// Seqlock around one frame - a single writer publishes without ever waiting, readers on other tasks
+// copy the frame out and retry if a publish overlapped their copy
+class FrameSnapshot {
+public:
+    void publish(const unsigned char* record, size_t length);
+
+    // Copies the frame into output (RECORD_LENGTH bytes) and returns its version,
+    // or 0 if nothing was published yet or the writer kept getting in the way
+    uint32_t read(unsigned char* output) const;
+
+    // Number of frames published so far
+    uint32_t getVersion() const;
+
+    // The frame itself - only safe to read from the writer's context
+    const unsigned char* data() const;
+private:
+    unsigned char frame[RECORD_LENGTH];
+    std::atomic<uint32_t> sequence { 0 }; // Odd while a publish is in progress
+};
+
+#endif // FRAME_SNAPSHOT_H
\ No newline at end of file
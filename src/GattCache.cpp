@@ -0,0 +1,80 @@
+#include "GattCache.h"
+
+#ifdef PERSIST_GATT_CACHE
+#include "Config.h"
+#endif
+
+GattCache& GattCache::getInstance() {
+    static GattCache instance;
+    return instance;
+}
+
+const GattHandles* GattCache::find(const uint8_t* address) {
+    load();
+
+    for (size_t i = 0; i < MAX_SCAN_DEVICES; i++) {
+        if (entries[i].valid && memcmp(entries[i].address, address, sizeof(entries[i].address)) == 0) {
+            return &entries[i];
+        }
+    }
+
+    return nullptr;
+}
+
+void GattCache::store(const GattHandles& handles) {
+    load();
+
+    GattHandles* entry = nullptr;
+    for (size_t i = 0; i < MAX_SCAN_DEVICES && !entry; i++) {
+        if (entries[i].valid && memcmp(entries[i].address, handles.address, sizeof(handles.address)) == 0) {
+            entry = &entries[i];
+        }
+    }
+
+    for (size_t i = 0; i < MAX_SCAN_DEVICES && !entry; i++) {
+        if (!entries[i].valid) {
+            entry = &entries[i];
+        }
+    }
+
+    if (!entry) {
+        entry = &entries[nextEntry];
+        nextEntry = (nextEntry + 1) % MAX_SCAN_DEVICES;
+    }
+
+    GattHandles updated = handles;
+    updated.valid = 1;
+
+    if (memcmp(entry, &updated, sizeof(updated)) == 0) {
+        return; // Nothing new to save
+    }
+
+    *entry = updated;
+    save();
+}
+
+void GattCache::invalidate(const uint8_t* address) {
+    GattHandles* entry = const_cast<GattHandles*>(find(address));
+    if (entry) {
+        entry->valid = 0;
+        save();
+    }
+}
+
+void GattCache::load() {
+    if (loaded) {
+        return;
+    }
+
+    loaded = true;
+#ifdef PERSIST_GATT_CACHE
+    memcpy(entries, Config::getInstance().gattHandles, sizeof(entries));
+#endif
+}
+
+void GattCache::save() {
+#ifdef PERSIST_GATT_CACHE
+    memcpy(Config::getInstance().gattHandles, entries, sizeof(entries));
+    Config::save();
+#endif
+}
\ No newline at end of file
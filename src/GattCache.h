@@ -0,0 +1,26 @@
+#ifndef GATT_CACHE_H
+#define GATT_CACHE_H
+
+#include "models/constants.h"
+#include "models/gatt_handles.h"
+
+// Discovered handles per BMS address, so a reconnect can subscribe without discovering attributes again.
+// Kept in RAM, and in Config on LittleFS when built with PERSIST_GATT_CACHE.
+class GattCache {
+public:
+    static GattCache& getInstance();
+
+    const GattHandles* find(const uint8_t* address);
+    void store(const GattHandles& handles);
+    // For when a cached handle was rejected - the next connect discovers again
+    void invalidate(const uint8_t* address);
+private:
+    GattHandles entries[MAX_SCAN_DEVICES] = {};
+    size_t nextEntry = 0; // Replaced next when the cache is full
+    bool loaded = false;
+
+    void load();
+    void save();
+};
+
+#endif // GATT_CACHE_H
\ No newline at end of file
@@ -1,29 +1,39 @@
 #include "JKBMS.h"
 
+#include <algorithm>
+
+std::atomic<JKBMS*> JKBMS::establishing { nullptr };
+
 #ifdef ESP32
 void JKBMS::init() {
     NimBLEDevice::init("JKBMS");
     NimBLEDevice::setPower(ESP_PWR_LVL_P9, NimBLETxPowerType::All);
     NimBLEDevice::setMTU(512);
+    ScanCoordinator::getInstance().begin();
 }
 
-JKBMS::JKBMS(const std::string& mac) {
+JKBMS::JKBMS(const std::string& mac) : session(buffer, *this) {
     macAddress = NimBLEAddress(mac, 0);
-
-    bleScan = NimBLEDevice::getScan();
-    bleScan->setInterval(SCAN_INTERVAL);
-    bleScan->setWindow(SCAN_WINDOW);
-    bleScan->setActiveScan(true);
+    scanSlot = ScanCoordinator::getInstance().addDevice(macAddress.getVal());
+    buffer.addListener(this);
 }
 
 void JKBMS::connect() {
-    lastActivity = millis();
     runFlag = true;
-    buffer.resetParsedData();
+    session.begin();
+    incoming.clear();
+    establishing = this;
+
+    // Skip the scan if the device was seen recently
+    ScanCoordinator& scanner = ScanCoordinator::getInstance();
+    if (scanner.isFresh(scanSlot)) {
+        Serial.println("Device seen recently, connecting...");
+        readyToConnect = true;
+        return;
+    }
 
-    // Scan for devices
-    bleScan->setScanCallbacks(this);
-    bleScan->start(SCAN_TIME);
+    waitingForScan = true;
+    scanner.requestScan();
     Serial.println("Scanning for devices...");
 }
 
@@ -36,35 +46,25 @@ void JKBMS::disconnect() {
 
     Serial.printf("Destroying BLE client %p\n", bleClient);
     bleClient = nullptr;
-    bleDevice = nullptr;
+    waitingForScan = false;
+    readyToConnect = false;
     bleService = nullptr;
     bleCharacteristic = nullptr;
+    connectionHandle = BLE_HS_CONN_HANDLE_NONE;
+    usingCachedHandles = false;
+    cachedSubscribeStatus = -1;
     runFlag = false;
-}
-
-void JKBMS::onResult(const NimBLEAdvertisedDevice* advertisedDevice) {
-    // Handle the result of the scan
-    Serial.printf("Found device: %s\n", advertisedDevice->getAddress().toString().c_str());
-    if (advertisedDevice->getAddress() == macAddress) {
-        Serial.println("Found target device, connecting...");
-        bleDevice = advertisedDevice;
-        bleScan->stop();
-        lastActivity = millis();
-        readyToConnect = true;
-    }
-}
-
-void JKBMS::onScanEnd(const NimBLEScanResults& results, int reason)
-{
-    // Handle the end of the scan
-    Serial.println("Scan ended");
-    runFlag = false;
+    session.end();
+    releaseLink();
 }
 
 void JKBMS::onConnect(NimBLEClient* pClient) {
     Serial.printf("Connected to: %s\n", pClient->getPeerAddress().toString().c_str());
-    lastActivity = millis();
+    connectionHandle = pClient->getConnHandle();
+    connectedTime = millis();
+    session.onConnected();
     readyToExchange = true;
+    releaseLink();
 }
 
 void JKBMS::onPostConnect() {
@@ -76,7 +76,12 @@ void JKBMS::onPostConnect() {
         return; // We should not be here
     }
 
-    lastActivity = millis();
+    session.touch();
+
+    if (subscribeWithCachedHandles()) {
+        return;
+    }
+
     // NOTE: ble_att_clt_tx_mtu in ble_att_clt.c needs to be modified to not set BLE_HS_EALREADY
     Serial.printf("Locating attributes...\n");
     bleClient->discoverAttributes();
@@ -108,16 +113,98 @@ void JKBMS::onPostConnect() {
         Serial.printf("Found characteristic: %s\n", bleCharacteristic->getUUID().toString().c_str());
 #endif
         Serial.println("Subscribing to notifications...");
-        bleCharacteristic->subscribe(true, [this](NimBLERemoteCharacteristic* characteristic, uint8_t* data, size_t length, bool isNotify) {
+        if (bleCharacteristic->subscribe(true, [this](NimBLERemoteCharacteristic* characteristic, uint8_t* data, size_t length, bool isNotify) {
             notificationCallback(characteristic, data, length, isNotify);
-        }, false);
-        Serial.println("Requesting battery info...");
-        bleCharacteristic->writeValue(GET_BATTERY_INFO);
+        }, false)) {
+            storeDiscoveredHandles();
+        }
+        startRequests();
+    }
+}
+
+bool JKBMS::subscribeWithCachedHandles() {
+    const GattHandles* handles = GattCache::getInstance().find(macAddress.getVal());
+    if (!handles || !handles->configHandle) {
+        return false;
+    }
+
+    if (!gapListenerRegistered) {
+        // Notifications for handles NimBLE did not discover never reach a subscribe callback, so listen for them here
+        gapListenerRegistered = ble_gap_event_listener_register(&gapListener, handleGapEvent, this) == 0;
+        if (!gapListenerRegistered) {
+            return false;
+        }
+    }
+
+    cachedHandles = *handles;
+    usingCachedHandles = true;
+    cachedSubscribeStatus = -1;
+
+    static const uint8_t enableNotifications[] = { 0x01, 0x00 };
+    Serial.println("Subscribing to notifications with cached handles...");
+    if (ble_gattc_write_flat(connectionHandle, cachedHandles.configHandle, enableNotifications, sizeof(enableNotifications), handleCachedSubscribe, this) != 0) {
+        usingCachedHandles = false;
+        GattCache::getInstance().invalidate(macAddress.getVal());
+        return false;
     }
+
+    return true;
+}
+
+int JKBMS::handleCachedSubscribe(uint16_t connHandle, const ble_gatt_error* error, ble_gatt_attr* attr, void* arg) {
+    // Runs in the NimBLE host task - monitor() picks up the result
+    static_cast<JKBMS*>(arg)->cachedSubscribeStatus = error ? error->status : 0;
+    return 0;
+}
+
+int JKBMS::handleGapEvent(ble_gap_event* event, void* arg) {
+    JKBMS* self = static_cast<JKBMS*>(arg);
+
+    if (
+        event->type != BLE_GAP_EVENT_NOTIFY_RX ||
+        !self->usingCachedHandles ||
+        event->notify_rx.conn_handle != self->connectionHandle ||
+        event->notify_rx.attr_handle != self->cachedHandles.valueHandle
+    ) {
+        return 0;
+    }
+
+    unsigned char data[NOTIFICATION_BUFFER_SIZE];
+    uint16_t length = 0;
+    if (ble_hs_mbuf_to_flat(event->notify_rx.om, data, sizeof(data), &length) == 0) {
+        self->incoming.push(data, length);
+    }
+
+    return 0;
+}
+
+void JKBMS::storeDiscoveredHandles() {
+    NimBLERemoteDescriptor* configDescriptor = bleCharacteristic->getDescriptor(NimBLEUUID((uint16_t) 0x2902));
+    if (!configDescriptor) {
+        return;
+    }
+
+    GattHandles handles = {};
+    memcpy(handles.address, macAddress.getVal(), sizeof(handles.address));
+    handles.serviceStart = bleService->getStartHandle();
+    handles.serviceEnd = bleService->getEndHandle();
+    handles.valueHandle = bleCharacteristic->getHandle();
+    handles.configHandle = configDescriptor->getHandle();
+    GattCache::getInstance().store(handles);
+}
+
+bool JKBMS::sendCommand(const unsigned char* command, size_t length) {
+    if (usingCachedHandles) {
+        return ble_gattc_write_no_rsp_flat(connectionHandle, cachedHandles.valueHandle, command, length) == 0;
+    }
+
+    return bleCharacteristic && bleCharacteristic->writeValue(command, length);
 }
 
 void JKBMS::onConnectFail(NimBLEClient* pClient, int reason) {
     Serial.printf("Failed to connect to: %s, reason = %d\n", pClient->getPeerAddress().toString().c_str(), reason);
+    ScanCoordinator::getInstance().forget(scanSlot); // Scan again next time
+    session.fail(FAILURE_CONNECT);
     bleClient = nullptr;
     disconnect();
 }
@@ -129,67 +216,91 @@ void JKBMS::onDisconnect(NimBLEClient* pClient, int reason) {
 }
 
 void JKBMS::notificationCallback(NimBLERemoteCharacteristic *characteristic, uint8_t *data, size_t length, bool isNotify) {
-    if (buffer.handleNotification(data, length)) {
-        lastActivity = millis();
+    // Runs in the NimBLE host task - only queue the bytes, monitor() parses them
+    incoming.push(data, length);
+}
 
-#ifdef JKBMS_DEBUG
-        Serial.println("Notification processed successfully");
-        Serial.printf("- Battery info: %s\n", buffer.getBatteryInfo() ? "Received" : "N/A");
-        Serial.printf("- Settings info: %s\n", buffer.getSettingsInfo() ? "Received" : "N/A");
-        Serial.printf("- Cell info: %s\n", buffer.getCellInfo() ? "Received" : "N/A");
-#endif
+void JKBMS::monitor() {
+    processNotifications();
+
+    unsigned long currentTime = millis();
 
-        if (buffer.getBatteryInfo() && !buffer.getCellInfo() && !buffer.getSettingsInfo()) {
-            // If we have battery data, we should send a request for cell data
-            Serial.println("Requesting settings info...");
-            bleCharacteristic->writeValue(GET_SETTINGS_INFO);
-        } else if (buffer.getSettingsInfo() && !buffer.getCellInfo()) {
-            // If we have settings data, we should send a request for cell data
-            Serial.println("Requesting cell info...");
-        } else if (buffer.getCellInfo()) {
-            // If we have cell data, we're done - disconnect
-            Serial.println("Received cell info, disconnecting...");
+    if (waitingForScan && !ScanCoordinator::getInstance().isScanning()) {
+        waitingForScan = false;
+
+        if (ScanCoordinator::getInstance().isFresh(scanSlot)) {
+            Serial.println("Found target device, connecting...");
+            session.touch();
+            readyToConnect = true;
+        } else {
+            Serial.println("Target device not found");
+            session.fail(FAILURE_SCAN_MISS);
             disconnect();
+            return;
         }
     }
-}
 
-void JKBMS::monitor() {
-    unsigned long currentTime = millis();
-
-    if (readyToConnect && bleDevice) {
+    if (readyToConnect) {
         readyToConnect = false;
         connectToDevice();
     }
 
-    if (readyToExchange && currentTime - lastActivity > EXCHANGE_TIME && lastActivity - currentTime > INTERRUPT_MAX_DESYNC) {
+    if (usingCachedHandles && cachedSubscribeStatus >= 0) {
+        int status = cachedSubscribeStatus.exchange(-1);
+
+        if (status == 0) {
+            startRequests();
+        } else {
+            // The handles moved, e.g. after a firmware update - discover them again
+            Serial.printf("Cached handles rejected (status %d), discovering attributes...\n", status);
+            usingCachedHandles = false;
+            GattCache::getInstance().invalidate(macAddress.getVal());
+            onPostConnect();
+        }
+    }
+
+    if (readyToExchange && currentTime - connectedTime > EXCHANGE_TIME && connectedTime - currentTime > INTERRUPT_MAX_DESYNC) {
         // Start exchanging data
         readyToExchange = false;
         onPostConnect();
     }
 
-    // Due to interrupts, lastActivity may be greater than currentTime - need to handle this scenario due to underflow
-    if (currentTime - lastActivity > ACTIVITY_TIMEOUT && lastActivity - currentTime > INTERRUPT_MAX_DESYNC && bleDevice) {
-        // No activity - disconnect
-        Serial.printf("No activity - disconnecting (%d ms)\n", currentTime - lastActivity);
-        disconnect();
+    session.poll();
+}
+
+void JKBMS::endSession(JKBMSSessionState result) {
+    if (result == SESSION_TIMED_OUT && usingCachedHandles && !buffer.hasBatteryInfo()) {
+        // Nothing ever came back on the cached handles
+        GattCache::getInstance().invalidate(macAddress.getVal());
     }
+
+    disconnect();
+}
+
+const uint8_t* JKBMS::getAddressBytes() const {
+    return macAddress.getVal();
 }
 
 void JKBMS::connectToDevice() {
+    // Use the address type the device actually advertised with
+    const ScanSighting* sighting = ScanCoordinator::getInstance().getSighting(scanSlot);
+    NimBLEAddress peerAddress = sighting ? NimBLEAddress(sighting->address, sighting->addressType) : macAddress;
+
     if (NimBLEDevice::getCreatedClientCount()) {
         // See if we can free up a client
 
-        NimBLEClient* tempBleClient = NimBLEDevice::getClientByPeerAddress(bleDevice->getAddress());
+        NimBLEClient* tempBleClient = NimBLEDevice::getClientByPeerAddress(peerAddress);
         if (tempBleClient) {
             // Delete the existing client
             Serial.printf("Deleted existing client\n");
             NimBLEDevice::deleteClient(tempBleClient);
-        } else {
-            // Delete a stale client
+        } else if (NimBLEDevice::getCreatedClientCount() >= NIMBLE_MAX_CONNECTIONS) {
+            // Delete a stale client - only connected devices hold one, so a disconnected client is left over
             tempBleClient = NimBLEDevice::getDisconnectedClient();
-            Serial.printf("Deleted stale client\n");
-            NimBLEDevice::deleteClient(tempBleClient);
+            if (tempBleClient) {
+                Serial.printf("Deleted stale client\n");
+                NimBLEDevice::deleteClient(tempBleClient);
+            }
         }
     }
 
@@ -199,10 +310,10 @@ void JKBMS::connectToDevice() {
         return;
     }
 
-    Serial.printf("Creating new client for device: %s\n", bleDevice->getAddress().toString().c_str());
-    lastActivity = millis();
+    Serial.printf("Creating new client for device: %s\n", peerAddress.toString().c_str());
+    session.touch();
 
-    bleClient = NimBLEDevice::createClient(bleDevice->getAddress());
+    bleClient = NimBLEDevice::createClient(peerAddress);
     bleClient->setSelfDelete(true, true);
     bleClient->setClientCallbacks(this, false);
     bleClient->setConnectionParams(32, 160, 0, 500);
@@ -210,6 +321,7 @@ void JKBMS::connectToDevice() {
 
     if (!bleClient->connect(true, true, true)) {
         Serial.println("Failed to connect to device");
+        session.fail(FAILURE_CONNECT);
         disconnect();
         return;
     }
@@ -222,9 +334,9 @@ void JKBMS::connectToDevice() {
 #include <btstack_run_loop.h>
 
 btstack_packet_callback_registration_t JKBMS::hci_event_callback_registration;
-JKBMS* JKBMS::activeInstance = nullptr;
+JKBMS* JKBMS::instances[MAX_SCAN_DEVICES] = {};
 
-JKBMS::JKBMS(const std::string& mac) {
+JKBMS::JKBMS(const std::string& mac) : session(buffer, *this) {
     // Convert MAC address string to bd_addr_t
     
     for (int i = 0; i < 6; i++) {
@@ -233,6 +345,12 @@ JKBMS::JKBMS(const std::string& mac) {
     }
 
     macAddressType = BD_ADDR_TYPE_LE_PUBLIC;
+    scanSlot = ScanCoordinator::getInstance().addDevice(macAddress);
+    if (scanSlot >= 0) {
+        instances[scanSlot] = this;
+    }
+
+    buffer.addListener(this);
 }
 
 void JKBMS::init() {
@@ -250,92 +368,205 @@ void JKBMS::init() {
 
     // Start the Bluetooth stack
     hci_power_control(HCI_POWER_ON);
+    ScanCoordinator::getInstance().begin();
 
     Serial.println("Bluetooth initialized");
 }
 
 void JKBMS::connect() {
     // Start scanning
-    lastActivity = millis();
     runFlag = true;
-    buffer.resetParsedData();
-
-    // Bind event handlers
-    activeInstance = this;
+    session.begin();
+    incoming.clear();
+    establishing = this;
+
+    // Skip the scan if the device was seen recently
+    ScanCoordinator& scanner = ScanCoordinator::getInstance();
+    if (scanner.isFresh(scanSlot)) {
+        Serial.println("Device seen recently, connecting...");
+        connectToDevice();
+        return;
+    }
 
-    // Scan for devices
-    gap_set_scan_params(1, 48, 48, 0);
-    gap_start_scan();
+    waitingForScan = true;
+    scanner.requestScan();
     Serial.println("Scanning for devices...");
 }
 
+void JKBMS::connectToDevice() {
+    // Use the address type the device actually advertised with
+    const ScanSighting* sighting = ScanCoordinator::getInstance().getSighting(scanSlot);
+    if (sighting) {
+        macAddressType = (bd_addr_type_t) sighting->addressType;
+    }
+
+    Serial.printf("Connecting to device with addr %s.\n", bd_addr_to_str(macAddress));
+    connecting = gap_connect(macAddress, macAddressType) == ERROR_CODE_SUCCESS;
+    if (!connecting) {
+        Serial.println("Failed to start connecting");
+        session.fail(FAILURE_CONNECT);
+        disconnect();
+        return;
+    }
+
+    session.touch();
+}
+
 void JKBMS::disconnect() {
+    // Leave nothing behind in BTstack, the next session reuses the same listener and may run on another device's link
+    if (listenerRegistered) {
+        gatt_client_stop_listening_for_characteristic_value_updates(&notificationListener);
+    }
+
+    if (connecting) {
+        gap_connect_cancel();
+    }
+
     if (connectionHandle != HCI_CON_HANDLE_INVALID) {
         gap_disconnect(connectionHandle);
         Serial.println("Disconnected from device");
     }
 
-    // Stop scanning if still active
-    gap_stop_scan();
-    Serial.println("Stopped scanning");
-
-    activeInstance = nullptr;
+    waitingForScan = false;
+    connecting = false;
     connectionHandle = HCI_CON_HANDLE_INVALID;
     serviceFound = false;
     listenerRegistered = false;
     batteryInfoSent = false;
+    requestsDue = false;
+    usingCachedHandles = false;
 
     runFlag = false;
+    session.end();
+    releaseLink();
 
     Serial.println("Cleanup complete");
 }
 
-void JKBMS::static_handle_hci_event(uint8_t packet_type, uint16_t channel, unsigned char *packet, uint16_t size) {
-    if (activeInstance) {
-        activeInstance->handle_hci_event(packet_type, channel, packet, size);
+JKBMS* JKBMS::findByHandle(hci_con_handle_t handle) {
+    if (handle == HCI_CON_HANDLE_INVALID) {
+        return nullptr;
+    }
+
+    for (size_t i = 0; i < MAX_SCAN_DEVICES; i++) {
+        if (instances[i] && instances[i]->connectionHandle == handle) {
+            return instances[i];
+        }
     }
+
+    return nullptr;
 }
 
-void JKBMS::static_handle_gatt_client_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
-    if (activeInstance) {
-        activeInstance->handle_gatt_client_event(packet_type, channel, packet, size);
+JKBMS* JKBMS::findByAddress(const bd_addr_t address) {
+    for (size_t i = 0; i < MAX_SCAN_DEVICES; i++) {
+        if (instances[i] && memcmp(instances[i]->macAddress, address, sizeof(bd_addr_t)) == 0) {
+            return instances[i];
+        }
     }
+
+    return nullptr;
 }
 
-void JKBMS::handle_hci_event(uint8_t packet_type, uint16_t channel, unsigned char *packet, uint16_t size) {
-    bd_addr_t local_addr;
+void JKBMS::static_handle_hci_event(uint8_t packet_type, uint16_t channel, unsigned char *packet, uint16_t size) {
     if (packet_type != HCI_EVENT_PACKET) return;
 
-    bd_addr_t targetMacAddress;
-    bd_addr_type_t targetMacAddressType;
-    uint8_t event_type = hci_event_packet_get_type(packet);
+    JKBMS* instance = nullptr;
 
-    switch(event_type) {
+    switch (hci_event_packet_get_type(packet)) {
         case GAP_EVENT_ADVERTISING_REPORT:
-            gap_event_advertising_report_get_address(packet, targetMacAddress);
-            targetMacAddressType = (bd_addr_type_t) gap_event_advertising_report_get_address_type(packet);
-            // Serial.printf("Found device: %s\n", bd_addr_to_str(targetMacAddress));
+            // Adverts go to the shared scan, whichever device asked for it
+            ScanCoordinator::getInstance().handleAdvertisingReport(packet);
+            return;
+        case HCI_EVENT_LE_META:
+            if (hci_event_le_meta_get_subevent_code(packet) == HCI_SUBEVENT_LE_CONNECTION_COMPLETE) {
+                // No handle is known before this event, only the peer it was for
+                bd_addr_t peerAddress;
+                hci_subevent_le_connection_complete_get_peer_address(packet, peerAddress);
+                instance = findByAddress(peerAddress);
+            }
+            break;
+        case HCI_EVENT_DISCONNECTION_COMPLETE:
+            instance = findByHandle(hci_event_disconnection_complete_get_connection_handle(packet));
+            break;
+        default:
+            break;
+    }
 
-            if (memcmp(targetMacAddress, macAddress, 6) == 0) {
-                Serial.printf("Found target device: %s\n", bd_addr_to_str(targetMacAddress));
+    if (instance) {
+        instance->handle_hci_event(packet_type, channel, packet, size);
+    }
+}
 
-                gap_stop_scan();
-                Serial.printf("Connecting to device with addr %s.\n", bd_addr_to_str(targetMacAddress));
-                gap_connect(targetMacAddress, targetMacAddressType);
-                lastActivity = millis();
-            }
+void JKBMS::static_handle_gatt_client_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+    hci_con_handle_t handle = HCI_CON_HANDLE_INVALID;
 
+    switch (hci_event_packet_get_type(packet)) {
+        case GATT_EVENT_SERVICE_QUERY_RESULT:
+            handle = gatt_event_service_query_result_get_handle(packet);
+            break;
+        case GATT_EVENT_CHARACTERISTIC_QUERY_RESULT:
+            handle = gatt_event_characteristic_query_result_get_handle(packet);
+            break;
+        case GATT_EVENT_QUERY_COMPLETE:
+            handle = gatt_event_query_complete_get_handle(packet);
+            break;
+        case GATT_EVENT_NOTIFICATION:
+            handle = gatt_event_notification_get_handle(packet);
             break;
+        default:
+            printf("Unknown packet type 0x%02x\n", hci_event_packet_get_type(packet));
+            return;
+    }
+
+    // Events for a link that was already let go are dropped here
+    JKBMS* instance = findByHandle(handle);
+    if (instance) {
+        instance->handle_gatt_client_event(packet_type, channel, packet, size);
+    }
+}
+
+void JKBMS::handle_hci_event(uint8_t packet_type, uint16_t channel, unsigned char *packet, uint16_t size) {
+    if (packet_type != HCI_EVENT_PACKET) return;
+
+    uint8_t event_type = hci_event_packet_get_type(packet);
+
+    switch(event_type) {
         case HCI_EVENT_LE_META:
             // wait for connection complete
             switch (hci_event_le_meta_get_subevent_code(packet)) {
-                case HCI_SUBEVENT_LE_CONNECTION_COMPLETE:
-                    connectionHandle = hci_subevent_le_connection_complete_get_connection_handle(packet);
+                case HCI_SUBEVENT_LE_CONNECTION_COMPLETE: {
+                    hci_con_handle_t handle = hci_subevent_le_connection_complete_get_connection_handle(packet);
+                    uint8_t status = hci_subevent_le_connection_complete_get_status(packet);
+
+                    if (!connecting) {
+                        // Raced with a cancelled attempt - don't keep a link nobody is going to use
+                        if (status == ERROR_CODE_SUCCESS) {
+                            gap_disconnect(handle);
+                        }
+                        break;
+                    }
+
+                    connecting = false;
+                    releaseLink();
+
+                    if (status != ERROR_CODE_SUCCESS) {
+                        Serial.printf("Connection to %s failed, status 0x%02x\n", bd_addr_to_str(macAddress), status);
+                        session.fail(FAILURE_CONNECT);
+                        disconnect();
+                        break;
+                    }
+
+                    connectionHandle = handle;
                     Serial.printf("Connected, handle %u\n", connectionHandle);
-                    
-                    gatt_client_discover_primary_services_by_uuid16(static_handle_gatt_client_event, connectionHandle, 0xFFE0);
-                    lastActivity = millis();
+                    session.onConnected();
+
+
+                    if (!subscribeWithCachedHandles()) {
+                        gatt_client_discover_primary_services_by_uuid16(static_handle_gatt_client_event, connectionHandle, 0xFFE0);
+                    }
+                    session.touch();
                     break;
+                }
                 default:
                     break;
             }
@@ -366,8 +597,22 @@ void JKBMS::handle_gatt_client_event(uint8_t packet_type, uint16_t channel, uint
         case GATT_EVENT_QUERY_COMPLETE:
             att_status = gatt_event_query_complete_get_att_status(packet);
             
+            if (att_status != ATT_ERROR_SUCCESS && usingCachedHandles && !batteryInfoSent) {
+                // The handles moved, e.g. after a firmware update - discover them again
+                Serial.printf("Cached handles rejected (ATT 0x%02x), discovering services...\n", att_status);
+                gatt_client_stop_listening_for_characteristic_value_updates(&notificationListener);
+                GattCache::getInstance().invalidate(macAddress);
+                usingCachedHandles = false;
+                serviceFound = false;
+                listenerRegistered = false;
+                gatt_client_discover_primary_services_by_uuid16(static_handle_gatt_client_event, connectionHandle, 0xFFE0);
+                session.touch();
+                break;
+            }
+
             if (att_status != ATT_ERROR_SUCCESS){
                 printf("GATT_QUERY_RESULT, ATT Error 0x%02x.\n", att_status);
+                session.fail(FAILURE_DISCOVERY);
                 disconnect();
                 break;  
             } 
@@ -376,7 +621,7 @@ void JKBMS::handle_gatt_client_event(uint8_t packet_type, uint16_t channel, uint
                 serviceFound = true;
                 Serial.println("Searching for battery characteristic");
                 gatt_client_discover_characteristics_for_service_by_uuid16(static_handle_gatt_client_event, connectionHandle, &remoteService, 0xFFE1);
-                lastActivity = millis();
+                session.touch();
             } else if (!listenerRegistered) {
                 // register handler for notifications
                 listenerRegistered = true;
@@ -388,10 +633,12 @@ void JKBMS::handle_gatt_client_event(uint8_t packet_type, uint16_t channel, uint
                 if (!batteryInfoSent) {
                     batteryInfoSent = true;
                     Serial.printf("Notifications enabled, ATT status 0x%02x\n", gatt_event_query_complete_get_att_status(packet));
-                    delay(100); // Short delay to ensure notifications are enabled before sending data
-                    Serial.println("Requesting battery info...");
-                    memcpy((void*) sendBuffer, (const void*) GET_BATTERY_INFO, sizeof(GET_BATTERY_INFO));
-                    gatt_client_write_value_of_characteristic(static_handle_gatt_client_event, connectionHandle, remoteCharacteristic.value_handle, sizeof(GET_BATTERY_INFO), sendBuffer);
+                    if (!usingCachedHandles) {
+                        storeDiscoveredHandles();
+                    }
+                    // Short pause to ensure notifications are enabled before sending data - waited out in monitor()
+                    subscribedTime = millis();
+                    requestsDue = true;
                 }
             }
 
@@ -399,60 +646,186 @@ void JKBMS::handle_gatt_client_event(uint8_t packet_type, uint16_t channel, uint
         case GATT_EVENT_CHARACTERISTIC_QUERY_RESULT:
             Serial.println("Locating characteristic...");
             gatt_event_characteristic_query_result_get_characteristic(packet, &remoteCharacteristic);
-            lastActivity = millis();
+            session.touch();
             break;
         case GATT_EVENT_NOTIFICATION: {
             uint16_t length = gatt_event_notification_get_value_length(packet);
             const uint8_t *data = gatt_event_notification_get_value(packet);
 
-            if (buffer.handleNotification(data, length)) {
-                lastActivity = millis();
-
-        #ifdef JKBMS_DEBUG
-                Serial.println("Notification processed successfully");
-                Serial.printf("- Battery info: %s\n", buffer.getBatteryInfo() ? "Received" : "N/A");
-                Serial.printf("- Settings info: %s\n", buffer.getSettingsInfo() ? "Received" : "N/A");
-                Serial.printf("- Cell info: %s\n", buffer.getCellInfo() ? "Received" : "N/A");
-        #endif
-
-                if (buffer.getBatteryInfo() && !buffer.getCellInfo() && !buffer.getSettingsInfo()) {
-                    // If we have battery data, we should send a request for cell data
-                    Serial.println("Requesting settings info...");
-                    memcpy((void*) sendBuffer, (const void*) GET_SETTINGS_INFO, sizeof(GET_SETTINGS_INFO));
-                    gatt_client_write_value_of_characteristic(static_handle_gatt_client_event, connectionHandle, remoteCharacteristic.value_handle, sizeof(GET_SETTINGS_INFO), sendBuffer);
-                } else if (buffer.getSettingsInfo() && !buffer.getCellInfo()) {
-                    // If we have settings data, we should send a request for cell data
-                    Serial.println("Requesting cell info...");
-                } else if (buffer.getCellInfo()) {
-                    // If we have cell data, we're done - disconnect
-                    Serial.println("Received cell info, disconnecting...");
-                    disconnect();
-                }
-            }
+            // Runs in the BTstack context - only queue the bytes, monitor() parses them
+            incoming.push(data, length);
 
             break;
         }
         default:
-            printf("Unknown packet type 0x%02x\n", hci_event_packet_get_type(packet));
             break;
     }
 }
 
+bool JKBMS::subscribeWithCachedHandles() {
+    const GattHandles* handles = GattCache::getInstance().find(macAddress);
+    if (!handles) {
+        return false;
+    }
+
+    remoteService.start_group_handle = handles->serviceStart;
+    remoteService.end_group_handle = handles->serviceEnd;
+    remoteCharacteristic.start_handle = handles->characteristicStart;
+    remoteCharacteristic.value_handle = handles->valueHandle;
+    remoteCharacteristic.end_handle = handles->characteristicEnd;
+    remoteCharacteristic.properties = handles->properties;
+
+    // Skip straight to the subscribe step of the discovery sequence
+    serviceFound = true;
+    listenerRegistered = true;
+    usingCachedHandles = true;
+    gatt_client_listen_for_characteristic_value_updates(&notificationListener, static_handle_gatt_client_event, connectionHandle, &remoteCharacteristic);
+
+    Serial.println("Subscribing to notifications with cached handles...");
+    if (handles->configHandle) {
+        sendBuffer[0] = GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION;
+        sendBuffer[1] = 0;
+        gatt_client_write_value_of_characteristic(static_handle_gatt_client_event, connectionHandle, handles->configHandle, 2, sendBuffer);
+    } else {
+        gatt_client_write_client_characteristic_configuration(static_handle_gatt_client_event, connectionHandle, &remoteCharacteristic, GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION);
+    }
+
+    return true;
+}
+
+void JKBMS::storeDiscoveredHandles() {
+    GattHandles handles = {};
+    memcpy(handles.address, macAddress, sizeof(handles.address));
+    handles.serviceStart = remoteService.start_group_handle;
+    handles.serviceEnd = remoteService.end_group_handle;
+    handles.characteristicStart = remoteCharacteristic.start_handle;
+    handles.valueHandle = remoteCharacteristic.value_handle;
+    handles.characteristicEnd = remoteCharacteristic.end_handle;
+    handles.properties = remoteCharacteristic.properties;
+
+    // BTstack finds the CCCD itself - it can only be pinned down when it is the characteristic's only descriptor
+    if (remoteCharacteristic.end_handle == remoteCharacteristic.value_handle + 1) {
+        handles.configHandle = remoteCharacteristic.end_handle;
+    }
+
+    GattCache::getInstance().store(handles);
+}
+
+const uint8_t* JKBMS::getAddressBytes() const {
+    return macAddress;
+}
+
+bool JKBMS::sendCommand(const unsigned char* command, size_t length) {
+    if (!listenerRegistered || length > sizeof(sendBuffer)) {
+        return false;
+    }
+
+    memcpy((void*) sendBuffer, (const void*) command, length);
+    return gatt_client_write_value_of_characteristic(static_handle_gatt_client_event, connectionHandle, remoteCharacteristic.value_handle, length, sendBuffer) == ERROR_CODE_SUCCESS;
+}
+
+void JKBMS::endSession(JKBMSSessionState result) {
+    if (result == SESSION_TIMED_OUT) {
+        if (connectionHandle == HCI_CON_HANDLE_INVALID) {
+            // Never got connected - the sighting may be stale, scan again next time
+            ScanCoordinator::getInstance().forget(scanSlot);
+        } else if (usingCachedHandles && !buffer.hasBatteryInfo()) {
+            // Nothing ever came back on the cached handles
+            GattCache::getInstance().invalidate(macAddress);
+        }
+    }
+
+    disconnect();
+}
+
 void JKBMS::monitor() {
-    unsigned long currentTime = millis();
+    processNotifications();
 
-    // BTstack is running in the background - no need to call a poll function
+    ScanCoordinator& scanner = ScanCoordinator::getInstance();
+    scanner.poll();
 
-    // Due to interrupts, lastActivity may be greater than currentTime - need to handle this scenario due to underflow
-    if (isRunning() && currentTime - lastActivity > ACTIVITY_TIMEOUT && lastActivity - currentTime > INTERRUPT_MAX_DESYNC) {
-        // No activity - disconnect
-        Serial.printf("No activity - disconnecting (%d ms)\n", currentTime - lastActivity);
-        disconnect();
+    if (waitingForScan && !scanner.isScanning()) {
+        waitingForScan = false;
+
+        if (scanner.isFresh(scanSlot)) {
+            Serial.println("Found target device");
+            connectToDevice();
+        } else {
+            Serial.println("Target device not found");
+            session.fail(FAILURE_SCAN_MISS);
+            disconnect();
+            return;
+        }
+    }
+
+    if (requestsDue && millis() - subscribedTime >= SUBSCRIBE_SETTLE_TIME) {
+        requestsDue = false;
+        startRequests();
     }
+
+    // BTstack is running in the background - no need to call a poll function
+    session.poll();
 }
 
 #endif
 
+bool JKBMS::isEstablishing() {
+    return establishing.load() != nullptr;
+}
+
+void JKBMS::releaseLink() {
+    // Let the next device scan or connect
+    JKBMS* self = this;
+    establishing.compare_exchange_strong(self, nullptr);
+}
+
+void JKBMS::startRequests() {
+    // Battery info rarely changes - reuse the last one unless it is due for a refresh
+    const unsigned char* storedRecord = BatteryInfoCache::getInstance().beginSession(getAddressBytes());
+    // The restored record reaches onBatteryInfo() from within onSubscribed(), and must not be stored back
+    restoringBatteryInfo = true;
+    batteryInfoRestored = session.onSubscribed(storedRecord);
+    restoringBatteryInfo = false;
+}
+
+void JKBMS::onBatteryInfo(const BatteryFrame& frame) {
+    if (!restoringBatteryInfo && !batteryInfoRestored) {
+        BatteryInfoCache::getInstance().store(getAddressBytes(), frame.data);
+    }
+}
+
+void JKBMS::processNotifications() {
+    if (incoming.getDroppedNotifications() != reportedDrops) {
+        reportedDrops = incoming.getDroppedNotifications();
+        Serial.printf("Notification queue full, %u notifications dropped so far\n", reportedDrops);
+    }
+
+    // Only drain what is queued now, so a busy link cannot keep the loop here
+    unsigned char chunk[NOTIFICATION_BUFFER_SIZE];
+    size_t remaining = incoming.available();
+    while (remaining > 0) {
+        size_t length = incoming.pop(chunk, std::min(remaining, sizeof(chunk)));
+        if (length == 0) {
+            break;
+        }
+
+        remaining -= length;
+        session.handleNotification(chunk, length);
+    }
+}
+
+bool JKBMS::hasBatteryInfo() const {
+    return buffer.hasBatteryInfo();
+}
+
+bool JKBMS::hasSettingsInfo() const {
+    return buffer.hasSettingsInfo();
+}
+
+bool JKBMS::hasCellInfo() const {
+    return buffer.hasCellInfo();
+}
+
 const BatteryInfo* JKBMS::getBatteryInfo() const {
     return buffer.getBatteryInfo();
 }
@@ -465,6 +838,22 @@ const CellInfo* JKBMS::getCellInfo() const {
     return buffer.getCellInfo();
 }
 
+bool JKBMS::snapshotBatteryInfo(BatteryInfo& info, uint32_t* version) const {
+    return buffer.snapshotBatteryInfo(info, version);
+}
+
+bool JKBMS::snapshotSettingsInfo(SettingsInfo& info, uint32_t* version) const {
+    return buffer.snapshotSettingsInfo(info, version);
+}
+
+bool JKBMS::snapshotCellInfo(CellInfo& info, uint32_t* version) const {
+    return buffer.snapshotCellInfo(info, version);
+}
+
+bool JKBMS::addRecordListener(JKBMSRecordListener* listener) {
+    return buffer.addListener(listener);
+}
+
 const JKBMSNotificationBuffer& JKBMS::getNotificationBuffer() const {
     return buffer;
 }
@@ -473,6 +862,34 @@ void JKBMS::resetParsedData() {
     buffer.resetParsedData();
 }
 
+void JKBMS::resetCellInfo() {
+    buffer.resetCellInfo();
+}
+
+void JKBMS::setPersistent(bool persistent) {
+    session.setPersistent(persistent);
+}
+
+bool JKBMS::isPersistent() const {
+    return session.isPersistent();
+}
+
+const JKBMSSession& JKBMS::getSession() const {
+    return session;
+}
+
+void JKBMS::getAddress(uint8_t* output) const {
+    const uint8_t* bytes = getAddressBytes();
+#ifdef ESP32
+    // NimBLE keeps addresses least significant byte first
+    for (size_t i = 0; i < 6; i++) {
+        output[i] = bytes[5 - i];
+    }
+#else
+    memcpy(output, bytes, 6);
+#endif
+}
+
 bool JKBMS::isRunning() const {
     return runFlag;
 }
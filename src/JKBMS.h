@@ -6,13 +6,19 @@
 #include "models/settings_info.h"
 #include "models/cell_info.h"
 #include "JKBMSNotificationBuffer.h"
+#include "JKBMSSession.h"
+#include "NotificationRing.h"
+#include "ScanCoordinator.h"
+#include "GattCache.h"
+#include "BatteryInfoCache.h"
 
+#include <atomic>
 #include <string>
 
 #ifdef ESP32
 #include <NimBLEDevice.h>
 
-class JKBMS : public NimBLEScanCallbacks, public NimBLEClientCallbacks
+class JKBMS : public NimBLEClientCallbacks, public JKBMSTransport, public JKBMSRecordListener
 {
 public:
     JKBMS(const std::string& mac);
@@ -22,38 +28,79 @@ public:
     void disconnect();
     void monitor();
     
+    bool hasBatteryInfo() const;
+    bool hasSettingsInfo() const;
+    bool hasCellInfo() const;
     const BatteryInfo* getBatteryInfo() const;
     const SettingsInfo* getSettingsInfo() const;
     const CellInfo* getCellInfo() const;
+    bool snapshotBatteryInfo(BatteryInfo& info, uint32_t* version = nullptr) const;
+    bool snapshotSettingsInfo(SettingsInfo& info, uint32_t* version = nullptr) const;
+    bool snapshotCellInfo(CellInfo& info, uint32_t* version = nullptr) const;
     const JKBMSNotificationBuffer& getNotificationBuffer() const;
+    bool addRecordListener(JKBMSRecordListener* listener);
     void resetParsedData();
+    void resetCellInfo();
+
+    // Stay subscribed after the first cell info and take every streamed frame as a new sample
+    void setPersistent(bool persistent);
+    bool isPersistent() const;
+    const JKBMSSession& getSession() const;
+    // Bluetooth address, most significant byte first as it is usually written
+    void getAddress(uint8_t* output) const;
 
     bool isRunning() const;
+    // True while a device is scanning or setting up its connection - NimBLE can only do one of those at a time
+    static bool isEstablishing();
 
 private:
+    static std::atomic<JKBMS*> establishing;
+
     NimBLEAddress macAddress;
-    NimBLEScan* bleScan;
+    int scanSlot = -1;
 
     bool runFlag = false; // Atomic flag to indicate if the BMS is running
-    const NimBLEAdvertisedDevice* bleDevice = nullptr;
+    bool waitingForScan = false;
     bool readyToConnect = false;
     bool readyToExchange = false;
-    unsigned long lastActivity = 0;
+    unsigned long connectedTime = 0;
     NimBLEClient* bleClient = nullptr;
 
     NimBLERemoteService* bleService = nullptr;
     NimBLERemoteCharacteristic* bleCharacteristic = nullptr;
 
+    // Reconnects with cached handles talk to the characteristic directly, without NimBLE's attribute objects
+    uint16_t connectionHandle = BLE_HS_CONN_HANDLE_NONE;
+    GattHandles cachedHandles;
+    bool usingCachedHandles = false;
+    std::atomic<int> cachedSubscribeStatus { -1 }; // -1 while waiting, then the ATT status of the CCCD write
+    bool gapListenerRegistered = false;
+    ble_gap_event_listener gapListener;
+
     JKBMSNotificationBuffer buffer;
+    JKBMSSession session;
+    bool batteryInfoRestored = false; // This session's battery info came from BatteryInfoCache
+    bool restoringBatteryInfo = false; // While startRequests() hands the cached record to the session
+    NotificationRing incoming; // Filled by the BLE callback, drained by monitor()
+    uint32_t reportedDrops = 0;
 
     void notificationCallback(NimBLERemoteCharacteristic* characteristic, uint8_t* data, size_t length, bool isNotify);
-    void onResult(const NimBLEAdvertisedDevice* advertisedDevice) override;
-    void onScanEnd(const NimBLEScanResults& results, int reason) override;
     void onConnect(NimBLEClient* pClient) override;
     void onPostConnect();
+    bool subscribeWithCachedHandles();
+    void storeDiscoveredHandles();
+    bool sendCommand(const unsigned char* command, size_t length) override;
+    static int handleGapEvent(ble_gap_event* event, void* arg);
+    static int handleCachedSubscribe(uint16_t connHandle, const ble_gatt_error* error, ble_gatt_attr* attr, void* arg);
     void onConnectFail(NimBLEClient* pClient, int reason) override;
     void onDisconnect(NimBLEClient* pClient, int reason) override;
     void connectToDevice();
+    void releaseLink();
+    void processNotifications();
+    void endSession(JKBMSSessionState result) override;
+    const uint8_t* getAddressBytes() const;
+    void startRequests();
+    void onBatteryInfo(const BatteryFrame& frame) override;
 };
 
 #endif
@@ -61,7 +108,7 @@ private:
 #ifdef ARDUINO_ARCH_RP2040
 #include <btstack.h>
 
-class JKBMS {
+class JKBMS : public JKBMSTransport, public JKBMSRecordListener {
 public:
     JKBMS(const std::string& mac);
 
@@ -70,40 +117,84 @@ public:
     void disconnect();
     void monitor();
     
+    bool hasBatteryInfo() const;
+    bool hasSettingsInfo() const;
+    bool hasCellInfo() const;
     const BatteryInfo* getBatteryInfo() const;
     const SettingsInfo* getSettingsInfo() const;
     const CellInfo* getCellInfo() const;
+    bool snapshotBatteryInfo(BatteryInfo& info, uint32_t* version = nullptr) const;
+    bool snapshotSettingsInfo(SettingsInfo& info, uint32_t* version = nullptr) const;
+    bool snapshotCellInfo(CellInfo& info, uint32_t* version = nullptr) const;
     const JKBMSNotificationBuffer& getNotificationBuffer() const;
+    bool addRecordListener(JKBMSRecordListener* listener);
     void resetParsedData();
+    void resetCellInfo();
+
+    // Stay subscribed after the first cell info and take every streamed frame as a new sample
+    void setPersistent(bool persistent);
+    bool isPersistent() const;
+    const JKBMSSession& getSession() const;
+    // Bluetooth address, most significant byte first as it is usually written
+    void getAddress(uint8_t* output) const;
 
     bool isRunning() const;
+    // True while a device is scanning or waiting for its connection - BTstack only runs one of those at a time
+    static bool isEstablishing();
 private:
+    static std::atomic<JKBMS*> establishing;
+
     bd_addr_t macAddress;
     bd_addr_type_t macAddressType; // bd_addr_type_t
+    int scanSlot = -1;
+    bool waitingForScan = false;
+    bool connecting = false; // gap_connect issued, waiting for the connection complete event
     hci_con_handle_t connectionHandle = HCI_CON_HANDLE_INVALID;
     bool serviceFound = false;
     gatt_client_service_t remoteService;
     gatt_client_characteristic_t remoteCharacteristic;
     bool listenerRegistered = false;
     gatt_client_notification_t notificationListener;
+    bool usingCachedHandles = false;
 
     bool runFlag = false; // Atomic flag to indicate if the BMS is running
-    unsigned long lastActivity = 0;
     JKBMSNotificationBuffer buffer;
+    JKBMSSession session;
+    bool batteryInfoRestored = false; // This session's battery info came from BatteryInfoCache
+    bool restoringBatteryInfo = false; // While startRequests() hands the cached record to the session
+    NotificationRing incoming; // Filled by the BLE callback, drained by monitor()
+    uint32_t reportedDrops = 0;
 
     bool batteryInfoSent = false;
+    // Set by the BTstack callback once notifications are on, monitor() starts the requests after SUBSCRIBE_SETTLE_TIME
+    std::atomic<bool> requestsDue { false };
+    unsigned long subscribedTime = 0;
 
     // For some reason, btstack does not allow const data in the write function, so we need this workaround
     unsigned char sendBuffer[sizeof(GET_BATTERY_INFO)];
 
     static void static_handle_hci_event(uint8_t packet_type, uint16_t channel, unsigned char *packet, uint16_t size);
     static void static_handle_gatt_client_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
-    // The static functions above are used to bind to the C-style callback system of btstack.
+    // The static functions above are used to bind to the C-style callback system of btstack,
+    // events are handed to the device they belong to by connection handle or peer address
     static btstack_packet_callback_registration_t hci_event_callback_registration;
-    static JKBMS* activeInstance;
+    static JKBMS* instances[MAX_SCAN_DEVICES]; // By scan slot
+
+    static JKBMS* findByHandle(hci_con_handle_t handle);
+    static JKBMS* findByAddress(const bd_addr_t address);
 
     void handle_hci_event(uint8_t packet_type, uint16_t channel, unsigned char *packet, uint16_t size);
     void handle_gatt_client_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+    void connectToDevice();
+    void releaseLink();
+    bool subscribeWithCachedHandles();
+    void storeDiscoveredHandles();
+    bool sendCommand(const unsigned char* command, size_t length) override;
+    void processNotifications();
+    void endSession(JKBMSSessionState result) override;
+    const uint8_t* getAddressBytes() const;
+    void startRequests();
+    void onBatteryInfo(const BatteryFrame& frame) override;
 };
 
 #endif
@@ -1,139 +1,409 @@
 #include "JKBMSNotificationBuffer.h"
 
-int JKBMSNotificationBuffer::findSOR() {
-    for (size_t i = 0; i <= notificationLength - sizeof(START_OF_RECORD);++i) {
-        if (memcmp(&notificationData[i], START_OF_RECORD, sizeof(START_OF_RECORD)) == 0) {
-            return i;
+#include <algorithm>
+
+static_assert(NOTIFICATION_BUFFER_SIZE >= RECORD_LENGTH, "Notification buffer must hold a full record");
+
+enum StreamToken {
+    TOKEN_KEEP_ALIVE,
+    TOKEN_PING_RESPONSE,
+    TOKEN_START_OF_RECORD,
+    TOKEN_COUNT
+};
+
+static const unsigned char* const TOKEN_BYTES[TOKEN_COUNT] = { KEEP_ALIVE, PING_RESPONSE, START_OF_RECORD };
+static const size_t TOKEN_LENGTHS[TOKEN_COUNT] = { sizeof(KEEP_ALIVE) - 1, sizeof(PING_RESPONSE), sizeof(START_OF_RECORD) };
+
+// Every token starts with a different byte, so the first byte alone picks the token a run of bytes could be
+static int tokenStartingWith(unsigned char value) {
+    for (int token = 0; token < TOKEN_COUNT; ++token) {
+        if (TOKEN_BYTES[token][0] == value) {
+            return token;
         }
     }
 
     return -1;
 }
 
-bool JKBMSNotificationBuffer::recordIsComplete() {
-    // Check if the buffer contains the start of a record
-    if (notificationLength < sizeof(START_OF_RECORD)) {
-        return false;
+static bool isTokenStart(unsigned char value) {
+    return value == KEEP_ALIVE[0] || value == PING_RESPONSE[0] || value == START_OF_RECORD[0];
+}
+
+// Every record type is a fixed size, with a checksum in the last byte
+static size_t recordLengthForType(unsigned char recordType) {
+    switch (recordType) {
+        case SETTINGS_INFO_RECORD_TYPE:
+        case CELL_INFO_RECORD_TYPE:
+        case BATTERY_INFO_RECORD_TYPE:
+            return RECORD_LENGTH;
+        default:
+            return 0;
     }
+}
+
+void JKBMSNotificationBuffer::appendBytes(const unsigned char* data, size_t length) {
+    while (length > 0) {
+        size_t count = std::min(length, (size_t) (NOTIFICATION_BUFFER_SIZE - writeIndex));
+        memcpy(&notificationData[writeIndex], data, count);
+
+        if (writeIndex < RECORD_LENGTH) {
+            // Mirror the start of the ring past the end, so wrapped records stay contiguous
+            memcpy(&notificationData[NOTIFICATION_BUFFER_SIZE + writeIndex], data, std::min(count, (size_t) (RECORD_LENGTH - writeIndex)));
+        }
+
+        writeIndex = (writeIndex + count) % NOTIFICATION_BUFFER_SIZE;
+        data += count;
+        length -= count;
+    }
+}
+
+bool JKBMSNotificationBuffer::appendPayload(const unsigned char* data, size_t length) {
+    bool recordProcessed = false;
+
+    // Outside a record there is nothing to keep
+    while (length > 0 && recordLength > 0) {
+        size_t target = expectedLength ? expectedLength : RECORD_TYPE_INDEX + 1;
+        size_t count = std::min(length, target - recordLength);
+
+        appendBytes(data, count);
+        recordLength += count;
+        data += count;
+        length -= count;
+
+        if (recordLength < target) {
+            break;
+        }
+
+        const unsigned char* record = &notificationData[recordStart];
+        if (expectedLength == 0) {
+            expectedLength = recordLengthForType(record[RECORD_TYPE_INDEX]);
+            if (expectedLength == 0) {
+                // Not a record we know the size of - resync on the next start of record
+                Serial.printf("Unknown record type: %02X\n", record[RECORD_TYPE_INDEX]);
+                frameStats.unknownRecords++;
+                recordLength = 0;
+            }
+        } else {
+            // Record complete - validate and parse it straight out of the ring
+            recordLength = 0;
+            recordProcessed |= processRecord(record, expectedLength);
+        }
+    }
+
+    return recordProcessed;
+}
+
+void JKBMSNotificationBuffer::handleToken(int token) {
+    switch (token) {
+        case TOKEN_KEEP_ALIVE:
+            frameStats.keepAlives++;
+            break;
+        case TOKEN_PING_RESPONSE:
+            frameStats.pingResponses++;
+            break;
+        case TOKEN_START_OF_RECORD:
+            if (recordLength > 0) {
+                Serial.printf("Record truncated after %d bytes\n", recordLength);
+                frameStats.truncatedRecords++;
+            }
 
-    // Search for the start of a record in the buffer
-    int startIndex = findSOR();
-    if (startIndex != -1) {
-#ifdef JKBMS_DEBUG
-        Serial.printf("Start of record found at index: %d\n", startIndex);
-#endif
-        shiftBufferToStart(startIndex);
-    } else {
 #ifdef JKBMS_DEBUG
-        Serial.println("No start of record found, discarding buffer.");
+            Serial.printf("Start of record found at ring index: %d\n", writeIndex);
 #endif
-        notificationLength = 0; // Discard all data if no start found
-        return false;
+            recordStart = writeIndex;
+            appendBytes(START_OF_RECORD, sizeof(START_OF_RECORD));
+            recordLength = sizeof(START_OF_RECORD);
+            expectedLength = 0;
+            break;
+        default:
+            break;
     }
+}
+
+bool JKBMSNotificationBuffer::consumeTokenByte(unsigned char value) {
+    bool recordProcessed = false;
+    pendingToken[pendingLength++] = value;
+
+    while (pendingLength > 0) {
+        if (recordLength > 0 && expectedLength != 0) {
+            // The record's length became known while bytes were held - they are its payload, whatever they look like
+            size_t count = std::min(pendingLength, expectedLength - recordLength);
+            recordProcessed |= appendPayload(pendingToken, count);
+            pendingLength -= count;
+            memmove(pendingToken, pendingToken + count, pendingLength);
+            continue;
+        }
 
-    // Check if the length of the record is valid
-    if (notificationLength > 300) { // 300 or 320
-        return true;
+        int token = tokenStartingWith(pendingToken[0]);
+        if (token >= 0 && pendingLength <= TOKEN_LENGTHS[token] && memcmp(pendingToken, TOKEN_BYTES[token], pendingLength) == 0) {
+            if (pendingLength == TOKEN_LENGTHS[token]) {
+                pendingLength = 0;
+                handleToken(token);
+            }
+
+            break;
+        }
+
+        // The held bytes cannot be a token - the first one is payload, the rest may still start one
+        recordProcessed |= appendPayload(pendingToken, 1);
+        memmove(pendingToken, pendingToken + 1, --pendingLength);
     }
 
-    return false;
+    return recordProcessed;
 }
 
-void JKBMSNotificationBuffer::shiftBufferToStart(size_t newStart) {
-    if (newStart < notificationLength) {
-        memmove(notificationData, &notificationData[newStart], notificationLength - newStart);
-        notificationLength -= newStart;
-    } else {
-        notificationLength = 0;
+bool JKBMSNotificationBuffer::processRecord(const unsigned char* record, size_t length) {
+    uint8_t checksum = crc8(record, length - 1);
+    if (checksum != record[length - 1]) {
+        Serial.printf("Record checksum mismatch (type %02X): expected %02X, got %02X\n", record[RECORD_TYPE_INDEX], record[length - 1], checksum);
+        frameStats.crcErrors++;
+        return false;
     }
-}
 
-void JKBMSNotificationBuffer::processRecord() {
-    if (notificationData[4] == BATTERY_INFO_RECORD_TYPE) {
-        BatteryInfo::parseBatteryInfo(notificationData, batteryInfo);
+    // Keep the frame as-is - fields are decoded when someone asks for them
+    if (record[RECORD_TYPE_INDEX] == BATTERY_INFO_RECORD_TYPE) {
+        batterySnapshot.publish(record, length);
 #ifdef JKBMS_DEBUG
-        Serial.println("Parsed battery info");
+        Serial.println("Stored battery info");
 #endif
-        batteryInfoValid = true;
-    } else if (notificationData[4] == SETTINGS_INFO_RECORD_TYPE) {
-        SettingsInfo::parseSettingsInfo(notificationData, settingsInfo);
+    } else if (record[RECORD_TYPE_INDEX] == SETTINGS_INFO_RECORD_TYPE) {
+        settingsSnapshot.publish(record, length);
 #ifdef JKBMS_DEBUG
-        Serial.println("Parsed settings info");
+        Serial.println("Stored settings info");
 #endif
-        settingsInfoValid = true;
-    } else if (notificationData[4] == CELL_INFO_RECORD_TYPE) {
-        CellInfo::parseCellInfo(notificationData, cellInfo);
+    } else if (record[RECORD_TYPE_INDEX] == CELL_INFO_RECORD_TYPE) {
+        cellSnapshot.publish(record, length);
 #ifdef JKBMS_DEBUG
-        Serial.println("Parsed cell info");
+        Serial.println("Stored cell info");
 #endif
-        cellInfoValid = true;
-    } else {
-        Serial.printf("Unknown record type: %02X\n", notificationData[4]);
     }
-}
 
-bool JKBMSNotificationBuffer::handleNotification(const unsigned char* data, size_t length) {
-    if (length + notificationLength > sizeof(notificationData)) {
-        // If incoming data exceeds buffer size, reset buffer
-        notificationLength = 0;
-    }
+    frameStats.recordsParsed++;
 
-    // Append new data to the buffer
-    for (size_t i = 0; i < length; ++i) {
-        if (memcmp(&data[i], KEEP_ALIVE, sizeof(KEEP_ALIVE) - 1) == 0) {
-            // If ping response found, skip those bytes
-            i += sizeof(KEEP_ALIVE) - 1;
+    for (size_t i = 0; i < MAX_RECORD_LISTENERS; ++i) {
+        if (!listeners[i]) {
             continue;
         }
 
-        notificationData[notificationLength++] = data[i];
+        if (record[RECORD_TYPE_INDEX] == BATTERY_INFO_RECORD_TYPE) {
+            listeners[i]->onBatteryInfo(BatteryFrame { record });
+        } else if (record[RECORD_TYPE_INDEX] == SETTINGS_INFO_RECORD_TYPE) {
+            listeners[i]->onSettingsInfo(SettingsFrame { record });
+        } else if (record[RECORD_TYPE_INDEX] == CELL_INFO_RECORD_TYPE) {
+            listeners[i]->onCellInfo(CellFrame { record });
+        }
     }
 
+    return true;
+}
+
+bool JKBMSNotificationBuffer::handleNotification(const unsigned char* data, size_t length) {
 #ifdef JKBMS_DEBUG
-    Serial.printf("Received message of %d bytes. Buffer length after append: %d\n", length, notificationLength);
-    for (size_t i = 0; i < notificationLength; ++i) {
-        Serial.printf("\\x%02X", notificationData[i]);
+    Serial.printf("Received message of %d bytes. Record length before append: %d\n", length, recordLength);
+    for (size_t i = 0; i < length; ++i) {
+        Serial.printf("\\x%02X", data[i]);
     }
     Serial.println();
 #endif
 
-    // Process complete records in the buffer
-    if (recordIsComplete()) {
-        processRecord();
-        notificationData[0] = 0; // Destroy SOR
-        int nextSOR = findSOR();
-        if (nextSOR != -1) {
-#ifdef JKBMS_DEBUG
-            Serial.printf("Next start of record found at index: %d\n", nextSOR);
-#endif
-            shiftBufferToStart(nextSOR);
-        } else {
-#ifdef JKBMS_DEBUG
-            Serial.println("No next start of record found, discarding buffer.");
-#endif
-            notificationLength = 0; // Discard all data if no start found
+    bool recordProcessed = false;
+    size_t i = 0;
+    while (i < length) {
+        if (recordLength > 0 && expectedLength != 0) {
+            // Once the record type is known its bytes are copied as they are - a checksum or cell value may well look
+            // like the start of a token, and the record is processed as soon as its last byte is in
+            size_t count = std::min(length - i, expectedLength - recordLength);
+            recordProcessed |= appendPayload(&data[i], count);
+            i += count;
+            continue;
+        }
+
+        if (pendingLength == 0 && !isTokenStart(data[i])) {
+            // Copy everything up to the next byte that could start a token in one go
+            size_t spanStart = i;
+            while (i < length && !isTokenStart(data[i])) {
+                ++i;
+            }
+
+            recordProcessed |= appendPayload(&data[spanStart], i - spanStart);
+            continue;
         }
 
-        return true;
+        recordProcessed |= consumeTokenByte(data[i++]);
+    }
+
+    return recordProcessed;
+}
+
+bool JKBMSNotificationBuffer::restoreRecord(const unsigned char* record, size_t length) {
+    if (length != RECORD_LENGTH || memcmp(record, START_OF_RECORD, sizeof(START_OF_RECORD)) != 0) {
+        return false;
     }
 
-    return false;
+    return processRecord(record, length);
 }
 
 void JKBMSNotificationBuffer::resetParsedData() {
-    batteryInfoValid = false;
-    settingsInfoValid = false;
-    cellInfoValid = false;
+    // Only remember what has been seen - the snapshots belong to the notification path
+    batteryInfoCleared.store(batterySnapshot.getVersion());
+    settingsInfoCleared.store(settingsSnapshot.getVersion());
+    cellInfoCleared.store(cellSnapshot.getVersion());
+}
+
+void JKBMSNotificationBuffer::resetCellInfo() {
+    cellInfoCleared.store(cellSnapshot.getVersion());
+}
+
+bool JKBMSNotificationBuffer::addListener(JKBMSRecordListener* listener) {
+    size_t freeSlot = MAX_RECORD_LISTENERS;
+    for (size_t i = 0; i < MAX_RECORD_LISTENERS; ++i) {
+        if (listeners[i] == listener) {
+            return true;
+        }
+
+        if (!listeners[i] && freeSlot == MAX_RECORD_LISTENERS) {
+            freeSlot = i;
+        }
+    }
+
+    if (freeSlot == MAX_RECORD_LISTENERS) {
+        Serial.println("No free record listener slots");
+        return false;
+    }
+
+    listeners[freeSlot] = listener;
+    return true;
+}
+
+void JKBMSNotificationBuffer::removeListener(JKBMSRecordListener* listener) {
+    for (size_t i = 0; i < MAX_RECORD_LISTENERS; ++i) {
+        if (listeners[i] == listener) {
+            listeners[i] = nullptr;
+        }
+    }
+}
+
+bool JKBMSNotificationBuffer::hasBatteryInfo() const {
+    return batterySnapshot.getVersion() > batteryInfoCleared.load();
+}
+
+bool JKBMSNotificationBuffer::hasSettingsInfo() const {
+    return settingsSnapshot.getVersion() > settingsInfoCleared.load();
+}
+
+bool JKBMSNotificationBuffer::hasCellInfo() const {
+    return cellSnapshot.getVersion() > cellInfoCleared.load();
+}
+
+// Copy a frame out of its snapshot, as long as it is newer than the last reset
+static const unsigned char* snapshotFrame(const FrameSnapshot& snapshot, const std::atomic<uint32_t>& cleared, unsigned char* output, uint32_t* version) {
+    uint32_t copied = snapshot.read(output);
+    if (copied <= cleared.load()) {
+        return nullptr;
+    }
+
+    if (version) {
+        *version = copied;
+    }
+
+    return output;
+}
+
+BatteryFrame JKBMSNotificationBuffer::snapshotBatteryFrame(unsigned char* output, uint32_t* version) const {
+    return BatteryFrame { snapshotFrame(batterySnapshot, batteryInfoCleared, output, version) };
+}
+
+SettingsFrame JKBMSNotificationBuffer::snapshotSettingsFrame(unsigned char* output, uint32_t* version) const {
+    return SettingsFrame { snapshotFrame(settingsSnapshot, settingsInfoCleared, output, version) };
+}
+
+CellFrame JKBMSNotificationBuffer::snapshotCellFrame(unsigned char* output, uint32_t* version) const {
+    return CellFrame { snapshotFrame(cellSnapshot, cellInfoCleared, output, version) };
+}
+
+bool JKBMSNotificationBuffer::snapshotBatteryInfo(BatteryInfo& info, uint32_t* version) const {
+    unsigned char frame[RECORD_LENGTH];
+    if (!snapshotFrame(batterySnapshot, batteryInfoCleared, frame, version)) {
+        return false;
+    }
+
+    BatteryInfo::parseBatteryInfo(frame, info);
+    return true;
+}
+
+bool JKBMSNotificationBuffer::snapshotSettingsInfo(SettingsInfo& info, uint32_t* version) const {
+    unsigned char frame[RECORD_LENGTH];
+    if (!snapshotFrame(settingsSnapshot, settingsInfoCleared, frame, version)) {
+        return false;
+    }
+
+    SettingsInfo::parseSettingsInfo(frame, info);
+    return true;
+}
+
+bool JKBMSNotificationBuffer::snapshotCellInfo(CellInfo& info, uint32_t* version) const {
+    unsigned char frame[RECORD_LENGTH];
+    if (!snapshotFrame(cellSnapshot, cellInfoCleared, frame, version)) {
+        return false;
+    }
+
+    CellInfo::parseCellInfo(frame, info);
+    return true;
+}
+
+BatteryFrame JKBMSNotificationBuffer::getBatteryFrame() const {
+    return BatteryFrame { hasBatteryInfo() ? batterySnapshot.data() : nullptr };
+}
+
+SettingsFrame JKBMSNotificationBuffer::getSettingsFrame() const {
+    return SettingsFrame { hasSettingsInfo() ? settingsSnapshot.data() : nullptr };
+}
+
+CellFrame JKBMSNotificationBuffer::getCellFrame() const {
+    return CellFrame { hasCellInfo() ? cellSnapshot.data() : nullptr };
 }
 
 const BatteryInfo* JKBMSNotificationBuffer::getBatteryInfo() const {
-    return batteryInfoValid ? &batteryInfo : nullptr;
+    if (!hasBatteryInfo()) {
+        return nullptr;
+    }
+
+    if (batterySnapshot.getVersion() != batteryInfoVersion) {
+        // On a failed copy the previous decode is kept
+        snapshotBatteryInfo(batteryInfo, &batteryInfoVersion);
+    }
+
+    return batteryInfoVersion > batteryInfoCleared.load() ? &batteryInfo : nullptr;
 }
 
 const SettingsInfo* JKBMSNotificationBuffer::getSettingsInfo() const {
-    return settingsInfoValid ? &settingsInfo : nullptr;
+    if (!hasSettingsInfo()) {
+        return nullptr;
+    }
+
+    if (settingsSnapshot.getVersion() != settingsInfoVersion) {
+        snapshotSettingsInfo(settingsInfo, &settingsInfoVersion);
+    }
+
+    return settingsInfoVersion > settingsInfoCleared.load() ? &settingsInfo : nullptr;
 }
 
 const CellInfo* JKBMSNotificationBuffer::getCellInfo() const {
-    return cellInfoValid ? &cellInfo : nullptr;
+    if (!hasCellInfo()) {
+        return nullptr;
+    }
+
+    if (cellSnapshot.getVersion() != cellInfoVersion) {
+        snapshotCellInfo(cellInfo, &cellInfoVersion);
+    }
+
+    return cellInfoVersion > cellInfoCleared.load() ? &cellInfo : nullptr;
+}
+
+const FrameStats& JKBMSNotificationBuffer::getFrameStats() const {
+    return frameStats;
+}
+
+uint32_t JKBMSNotificationBuffer::getRejectedRecords() const {
+    return frameStats.crcErrors + frameStats.unknownRecords;
 }
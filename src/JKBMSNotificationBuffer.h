@@ -5,31 +5,108 @@
 #include "models/battery_info.h"
 #include "models/settings_info.h"
 #include "models/cell_info.h"
+#include "FrameSnapshot.h"
+
+struct FrameStats {
+    uint32_t recordsParsed = 0;
+    uint32_t crcErrors = 0;
+    uint32_t unknownRecords = 0;
+    uint32_t truncatedRecords = 0;
+    uint32_t keepAlives = 0;
+    uint32_t pingResponses = 0;
+};
+
+// Told about each validated record as soon as its last byte arrives, from whichever context fed the notification
+class JKBMSRecordListener {
+public:
+    virtual ~JKBMSRecordListener() {}
+    virtual void onBatteryInfo(const BatteryFrame& frame) {}
+    virtual void onSettingsInfo(const SettingsFrame& frame) {}
+    virtual void onCellInfo(const CellFrame& frame) {}
+};
 
 class JKBMSNotificationBuffer {
 public:
+    // Processes every record completed by the notification, returns true if there was at least one
     bool handleNotification(const unsigned char* data, size_t length);
+    // Takes a complete record kept from an earlier session as if it had just been received - false if it fails validation
+    bool restoreRecord(const unsigned char* record, size_t length);
     void resetParsedData();
+    // Marks only the current cell info as consumed, e.g. after taking it as a sample from a stream
+    void resetCellInfo();
+
+    bool addListener(JKBMSRecordListener* listener);
+    void removeListener(JKBMSRecordListener* listener);
     
+    // Safe from any task
+    bool hasBatteryInfo() const;
+    bool hasSettingsInfo() const;
+    bool hasCellInfo() const;
+
+    // Consistent, versioned copies of the latest records, safe from any task and never blocking the notification path.
+    // Frame views point into output, which must hold RECORD_LENGTH bytes. Return false / an invalid view if there is nothing new.
+    BatteryFrame snapshotBatteryFrame(unsigned char* output, uint32_t* version = nullptr) const;
+    SettingsFrame snapshotSettingsFrame(unsigned char* output, uint32_t* version = nullptr) const;
+    CellFrame snapshotCellFrame(unsigned char* output, uint32_t* version = nullptr) const;
+    bool snapshotBatteryInfo(BatteryInfo& info, uint32_t* version = nullptr) const;
+    bool snapshotSettingsInfo(SettingsInfo& info, uint32_t* version = nullptr) const;
+    bool snapshotCellInfo(CellInfo& info, uint32_t* version = nullptr) const;
+
+    // Views onto the latest frame of each type - only from the context feeding notifications, e.g. in a listener
+    BatteryFrame getBatteryFrame() const;
+    SettingsFrame getSettingsFrame() const;
+    CellFrame getCellFrame() const;
+
+    // Decoded copies cached for the reader - use from one task only, the pointers stay valid until the next call
     const BatteryInfo* getBatteryInfo() const;
     const SettingsInfo* getSettingsInfo() const;
     const CellInfo* getCellInfo() const;
+
+    const FrameStats& getFrameStats() const;
+    uint32_t getRejectedRecords() const;
 private:
-    unsigned char notificationData[NOTIFICATION_BUFFER_SIZE];
-    size_t notificationLength = 0;
+    // Circular reassembly buffer - the first RECORD_LENGTH bytes are mirrored past the end,
+    // so a record that wraps around can still be parsed in place
+    unsigned char notificationData[NOTIFICATION_BUFFER_SIZE + RECORD_LENGTH];
+    size_t writeIndex = 0; // Next write position in the ring
+    size_t recordStart = 0; // Ring position of the record being assembled
+    size_t recordLength = 0; // Bytes of the current record received, 0 while searching for a start of record
+    size_t expectedLength = 0; // Full length of the current record, 0 until the record type is known
+
+    // Stream tokenizer, only run between records and before a record's type is known - bytes that could be the start of
+    // KEEP_ALIVE, PING_RESPONSE or START_OF_RECORD are held here until they either complete a token or turn out to be
+    // payload, so tokens can span notifications
+    unsigned char pendingToken[sizeof(START_OF_RECORD)];
+    size_t pendingLength = 0;
+
+    // Last validated frame of each record type, published by the notification path
+    FrameSnapshot batterySnapshot;
+    FrameSnapshot settingsSnapshot;
+    FrameSnapshot cellSnapshot;
+
+    // Versions already consumed by resetParsedData()
+    std::atomic<uint32_t> batteryInfoCleared { 0 };
+    std::atomic<uint32_t> settingsInfoCleared { 0 };
+    std::atomic<uint32_t> cellInfoCleared { 0 };
+
+    // Decoded on request whenever a newer frame is available
+    mutable BatteryInfo batteryInfo;
+    mutable SettingsInfo settingsInfo;
+    mutable CellInfo cellInfo;
+
+    mutable uint32_t batteryInfoVersion = 0;
+    mutable uint32_t settingsInfoVersion = 0;
+    mutable uint32_t cellInfoVersion = 0;
 
-    BatteryInfo batteryInfo;
-    SettingsInfo settingsInfo;
-    CellInfo cellInfo;
+    FrameStats frameStats;
 
-    bool batteryInfoValid = false;
-    bool settingsInfoValid = false;
-    bool cellInfoValid = false;
+    JKBMSRecordListener* listeners[MAX_RECORD_LISTENERS] = {};
 
-    int findSOR();
-    bool recordIsComplete();
-    void processRecord();
-    void shiftBufferToStart(size_t newStart);
+    bool consumeTokenByte(unsigned char value);
+    void handleToken(int token);
+    bool appendPayload(const unsigned char* data, size_t length);
+    void appendBytes(const unsigned char* data, size_t length);
+    bool processRecord(const unsigned char* record, size_t length);
 };
 
-#endif // JKBMS_NOTIFICATION_BUFFER_H
\ No newline at end of file
+#endif // JKBMS_NOTIFICATION_BUFFER_H
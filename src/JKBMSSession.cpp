@@ -0,0 +1,245 @@
+#include "JKBMSSession.h"
+
+const char* getFailureName(JKBMSFailure failure) {
+    switch (failure) {
+        case FAILURE_NONE:
+            return "none";
+        case FAILURE_SCAN_MISS:
+            return "scan miss";
+        case FAILURE_CONNECT:
+            return "connect failed";
+        case FAILURE_DISCOVERY:
+            return "discovery failed";
+        case FAILURE_TIMEOUT:
+            return "timeout";
+        case FAILURE_LINK_LOST:
+            return "link lost";
+        default:
+            return "unknown";
+    }
+}
+
+JKBMSSession::JKBMSSession(JKBMSNotificationBuffer& buffer, JKBMSTransport& transport, JKBMSClock clock, Print& log) :
+    buffer(buffer), transport(transport), clock(clock), log(log) {
+    buffer.addListener(this);
+}
+
+void JKBMSSession::begin() {
+    buffer.resetParsedData();
+    timings = JKBMSSessionTimings();
+    timings.started = clock();
+    lastActivity = timings.started;
+    failure = FAILURE_NONE;
+    state = SESSION_CONNECTING;
+}
+
+void JKBMSSession::touch() {
+    lastActivity = clock();
+}
+
+void JKBMSSession::onConnected() {
+    timings.connected = clock();
+    lastActivity = timings.connected;
+}
+
+void JKBMSSession::fail(JKBMSFailure reason) {
+    if (failure == FAILURE_NONE && isActive()) {
+        failure = reason;
+    }
+}
+
+bool JKBMSSession::onSubscribed(const unsigned char* knownBatteryRecord) {
+    if (state != SESSION_CONNECTING) {
+        return false;
+    }
+
+    timings.subscribed = clock();
+
+    if (knownBatteryRecord && buffer.restoreRecord(knownBatteryRecord, RECORD_LENGTH)) {
+        log.println("Using stored battery info, requesting settings info...");
+        request(SESSION_AWAITING_SETTINGS_INFO);
+        return true;
+    }
+
+    log.println("Requesting battery info...");
+    request(SESSION_AWAITING_BATTERY_INFO);
+    return false;
+}
+
+bool JKBMSSession::request(JKBMSSessionState nextState) {
+    state = nextState;
+    lastRequest = clock();
+    lastActivity = lastRequest;
+
+    // Cell info is streamed once the settings have been asked for, so both wait on the same request
+    bool sent;
+    if (nextState == SESSION_AWAITING_BATTERY_INFO) {
+        sent = transport.sendCommand(GET_BATTERY_INFO, sizeof(GET_BATTERY_INFO));
+    } else {
+        sent = transport.sendCommand(GET_SETTINGS_INFO, sizeof(GET_SETTINGS_INFO));
+    }
+
+    if (!sent) {
+        log.println("Request could not be sent");
+        lastRequest -= REQUEST_TIMEOUT + 1;
+    }
+
+    return sent;
+}
+
+void JKBMSSession::retry() {
+    unsigned long activity = lastActivity;
+    request(state);
+    lastActivity = activity; // Retries do not hold off the activity timeout
+}
+
+void JKBMSSession::handleNotification(const unsigned char* data, size_t length) {
+    uint32_t rejectedRecords = buffer.getRejectedRecords();
+    if (!buffer.handleNotification(data, length)) {
+        bool awaitingRequest = state == SESSION_AWAITING_BATTERY_INFO || state == SESSION_AWAITING_SETTINGS_INFO;
+        if (buffer.getRejectedRecords() != rejectedRecords && awaitingRequest && requestRetries < MAX_REQUEST_RETRIES) {
+            // Ask again for whatever we were waiting on, rather than waiting for the timeout - a BMS that keeps
+            // sending bad records still runs out of retries and into the activity timeout
+            requestRetries++;
+            log.printf("Rejected record, requesting again (retry %d)...\n", requestRetries);
+            retry();
+        }
+        return;
+    }
+
+    lastActivity = clock();
+
+#ifdef JKBMS_DEBUG
+    log.println("Notification processed successfully");
+    log.printf("- Battery info: %s\n", buffer.hasBatteryInfo() ? "Received" : "N/A");
+    log.printf("- Settings info: %s\n", buffer.hasSettingsInfo() ? "Received" : "N/A");
+    log.printf("- Cell info: %s\n", buffer.hasCellInfo() ? "Received" : "N/A");
+#endif
+}
+
+void JKBMSSession::poll() {
+    if (!isActive()) {
+        return;
+    }
+
+    unsigned long currentTime = clock();
+
+    // Due to interrupts, lastActivity may be greater than currentTime - need to handle this scenario due to underflow
+    if (currentTime - lastActivity > ACTIVITY_TIMEOUT && lastActivity - currentTime > INTERRUPT_MAX_DESYNC) {
+        // No activity - give up
+        log.printf("No activity - disconnecting (%lu ms)\n", currentTime - lastActivity);
+        finish(SESSION_TIMED_OUT);
+        return;
+    }
+
+    bool awaitingResponse = state == SESSION_AWAITING_BATTERY_INFO || state == SESSION_AWAITING_SETTINGS_INFO || state == SESSION_AWAITING_CELL_INFO;
+    if (awaitingResponse && currentTime - lastRequest > REQUEST_TIMEOUT && requestRetries < MAX_REQUEST_RETRIES) {
+        requestRetries++;
+        log.printf("No response, requesting again (retry %d)...\n", requestRetries);
+        retry();
+    }
+}
+
+void JKBMSSession::end() {
+    if (isActive()) {
+        // The link went away before the session finished
+        fail(classifyFailure(true));
+        state = SESSION_IDLE;
+    }
+
+    requestRetries = 0;
+}
+
+void JKBMSSession::finish(JKBMSSessionState result) {
+    if (result == SESSION_TIMED_OUT) {
+        fail(classifyFailure(false));
+    }
+
+    state = result;
+    requestRetries = 0;
+
+#ifdef JKBMS_DEBUG
+    if (result == SESSION_COMPLETE) {
+        log.printf("Session took %lu ms (subscribed %lu, battery %lu, settings %lu, cells %lu)\n",
+            timings.cellInfo - timings.started,
+            timings.subscribed - timings.started,
+            timings.batteryInfo - timings.started,
+            timings.settingsInfo - timings.started,
+            timings.cellInfo - timings.started);
+    }
+#endif
+
+    transport.endSession(result);
+}
+
+void JKBMSSession::onBatteryInfo(const BatteryFrame& frame) {
+    timings.batteryInfo = clock();
+
+    if (state == SESSION_AWAITING_BATTERY_INFO) {
+        // If we have battery data, we should send a request for cell data
+        log.println("Requesting settings info...");
+        requestRetries = 0;
+        request(SESSION_AWAITING_SETTINGS_INFO);
+    }
+}
+
+void JKBMSSession::onSettingsInfo(const SettingsFrame& frame) {
+    timings.settingsInfo = clock();
+
+    if (state == SESSION_AWAITING_SETTINGS_INFO) {
+        // Cell info follows the settings on its own
+        log.println("Requesting cell info...");
+        requestRetries = 0;
+        state = SESSION_AWAITING_CELL_INFO;
+        lastRequest = clock();
+    }
+}
+
+void JKBMSSession::onCellInfo(const CellFrame& frame) {
+    timings.cellInfo = clock();
+    requestRetries = 0;
+
+    if (persistent) {
+        // The BMS keeps pushing cell info while subscribed - each frame is a new sample
+        state = SESSION_STREAMING;
+        return;
+    }
+
+    if (isActive()) {
+        // If we have cell data, we're done
+        log.println("Received cell info, disconnecting...");
+        finish(SESSION_COMPLETE);
+    }
+}
+
+void JKBMSSession::setPersistent(bool persistent) {
+    this->persistent = persistent;
+}
+
+bool JKBMSSession::isPersistent() const {
+    return persistent;
+}
+
+JKBMSSessionState JKBMSSession::getState() const {
+    return state;
+}
+
+bool JKBMSSession::isActive() const {
+    return state != SESSION_IDLE && state != SESSION_COMPLETE && state != SESSION_TIMED_OUT;
+}
+
+const JKBMSSessionTimings& JKBMSSession::getTimings() const {
+    return timings;
+}
+
+JKBMSFailure JKBMSSession::getFailure() const {
+    return failure;
+}
+
+JKBMSFailure JKBMSSession::classifyFailure(bool linkLost) const {
+    if (state == SESSION_CONNECTING) {
+        return timings.connected ? FAILURE_DISCOVERY : FAILURE_CONNECT;
+    }
+
+    return linkLost ? FAILURE_LINK_LOST : FAILURE_TIMEOUT;
+}
\ No newline at end of file
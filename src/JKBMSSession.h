@@ -0,0 +1,107 @@
+#ifndef JKBMS_SESSION_H
+#define JKBMS_SESSION_H
+
+#include "models/constants.h"
+#include "JKBMSNotificationBuffer.h"
+
+enum JKBMSSessionState {
+    SESSION_IDLE,
+    SESSION_CONNECTING, // Scanning, connecting and subscribing - up to the transport
+    SESSION_AWAITING_BATTERY_INFO,
+    SESSION_AWAITING_SETTINGS_INFO,
+    SESSION_AWAITING_CELL_INFO,
+    SESSION_STREAMING, // Persistent sessions only, cell info keeps coming
+    SESSION_COMPLETE,
+    SESSION_TIMED_OUT
+};
+
+// Why a session ended without data - the first cause found is kept
+enum JKBMSFailure {
+    FAILURE_NONE,
+    FAILURE_SCAN_MISS, // Not seen in the scan
+    FAILURE_CONNECT, // Seen, but the connection was not established
+    FAILURE_DISCOVERY, // Connected, but the characteristic was not found or could not be subscribed to
+    FAILURE_TIMEOUT, // Subscribed, but the BMS stopped answering
+    FAILURE_LINK_LOST // Disconnected by the BMS or the stack in the middle of the session
+};
+
+const char* getFailureName(JKBMSFailure failure);
+
+// Clock time when each step of the last session was reached, 0 if it was not
+struct JKBMSSessionTimings {
+    unsigned long started = 0;
+    unsigned long connected = 0;
+    unsigned long subscribed = 0;
+    unsigned long batteryInfo = 0;
+    unsigned long settingsInfo = 0;
+    unsigned long cellInfo = 0;
+};
+
+// Milliseconds from a fixed point, millis() on the device - a fake clock lets a session run off-target
+typedef unsigned long (*JKBMSClock)();
+
+// What a session needs from the BLE stack underneath it
+class JKBMSTransport {
+public:
+    virtual ~JKBMSTransport() {}
+    virtual bool sendCommand(const unsigned char* command, size_t length) = 0;
+    // Called with SESSION_COMPLETE or SESSION_TIMED_OUT - the transport should drop the link
+    virtual void endSession(JKBMSSessionState result) = 0;
+};
+
+// The JK BMS request sequence (battery info, settings, then streamed cell info), its request pacing and timeouts,
+// independent of the BLE stack. Everything except touch(), onConnected() and fail() runs in the context that drains the notifications.
+class JKBMSSession : public JKBMSRecordListener {
+public:
+    JKBMSSession(JKBMSNotificationBuffer& buffer, JKBMSTransport& transport, JKBMSClock clock = millis, Print& log = Serial);
+
+    // Starts a new session, dropping the data of the previous one
+    void begin();
+    // Link progress (found, connected, discovered) - holds off the activity timeout
+    void touch();
+    void onConnected();
+    // The transport knows why the link failed - kept unless an earlier cause was already recorded
+    void fail(JKBMSFailure reason);
+    // Notifications are enabled - starts the request sequence, skipping the battery info request if a record
+    // from an earlier session is given and still valid. Returns true if it was used.
+    bool onSubscribed(const unsigned char* knownBatteryRecord = nullptr);
+    void handleNotification(const unsigned char* data, size_t length);
+    // Activity timeout and request retries
+    void poll();
+    // The link is gone
+    void end();
+
+    void setPersistent(bool persistent);
+    bool isPersistent() const;
+
+    JKBMSSessionState getState() const;
+    bool isActive() const;
+    const JKBMSSessionTimings& getTimings() const;
+    JKBMSFailure getFailure() const;
+private:
+    JKBMSNotificationBuffer& buffer;
+    JKBMSTransport& transport;
+    JKBMSClock clock;
+    Print& log;
+
+    JKBMSSessionState state = SESSION_IDLE;
+    bool persistent = false;
+    unsigned long lastActivity = 0;
+    unsigned long lastRequest = 0;
+    uint8_t requestRetries = 0;
+    JKBMSSessionTimings timings;
+    JKBMSFailure failure = FAILURE_NONE;
+
+    // Best guess from how far the session got, when the transport did not say
+    JKBMSFailure classifyFailure(bool linkLost) const;
+    // Sends the request for nextState - if the transport could not send it, the retry in poll() is due straight away
+    bool request(JKBMSSessionState nextState);
+    // Asks again for the current state, without holding off the activity timeout
+    void retry();
+    void finish(JKBMSSessionState result);
+    void onBatteryInfo(const BatteryFrame& frame) override;
+    void onSettingsInfo(const SettingsFrame& frame) override;
+    void onCellInfo(const CellFrame& frame) override;
+};
+
+#endif // JKBMS_SESSION_H
\ No newline at end of file
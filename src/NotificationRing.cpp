@@ -0,0 +1,56 @@
+#include "NotificationRing.h"
+
+#include <algorithm>
+
+#define NOTIFICATION_RING_MASK (NOTIFICATION_RING_SIZE - 1)
+
+static_assert((NOTIFICATION_RING_SIZE & NOTIFICATION_RING_MASK) == 0, "NOTIFICATION_RING_SIZE must be a power of two");
+
+bool NotificationRing::push(const unsigned char* bytes, size_t length) {
+    size_t writeIndex = head.load(std::memory_order_relaxed);
+    size_t readIndex = tail.load(std::memory_order_acquire);
+
+    if (length > NOTIFICATION_RING_SIZE - (writeIndex - readIndex)) {
+        droppedNotifications.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Copy in at most two spans, the second one wrapping around to the start
+    size_t offset = writeIndex & NOTIFICATION_RING_MASK;
+    size_t firstSpan = std::min(length, (size_t) NOTIFICATION_RING_SIZE - offset);
+    memcpy(data + offset, bytes, firstSpan);
+    memcpy(data, bytes + firstSpan, length - firstSpan);
+
+    head.store(writeIndex + length, std::memory_order_release);
+    return true;
+}
+
+size_t NotificationRing::pop(unsigned char* output, size_t capacity) {
+    size_t readIndex = tail.load(std::memory_order_relaxed);
+    size_t writeIndex = head.load(std::memory_order_acquire);
+
+    size_t length = std::min(capacity, writeIndex - readIndex);
+    if (length == 0) {
+        return 0;
+    }
+
+    size_t offset = readIndex & NOTIFICATION_RING_MASK;
+    size_t firstSpan = std::min(length, (size_t) NOTIFICATION_RING_SIZE - offset);
+    memcpy(output, data + offset, firstSpan);
+    memcpy(output + firstSpan, data, length - firstSpan);
+
+    tail.store(readIndex + length, std::memory_order_release);
+    return length;
+}
+
+void NotificationRing::clear() {
+    tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+size_t NotificationRing::available() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+uint32_t NotificationRing::getDroppedNotifications() const {
+    return droppedNotifications.load(std::memory_order_relaxed);
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#ifndef NOTIFICATION_RING_H
+#define NOTIFICATION_RING_H
+
+#include "models/constants.h"
+
+#include <atomic>
+
+// Lock-free single-producer/single-consumer byte queue - the BLE callback pushes raw notification bytes,
+// monitor() pops them and does the reassembly and parsing outside of the radio stack's context
+class NotificationRing {
+public:
+    // Producer side - queues the whole notification or nothing, so a full ring never splits one
+    bool push(const unsigned char* data, size_t length);
+
+    // Consumer side - copies up to capacity bytes into output and returns how many were copied
+    size_t pop(unsigned char* output, size_t capacity);
+    // Consumer side - throws away anything still queued
+    void clear();
+
+    size_t available() const;
+    uint32_t getDroppedNotifications() const;
+private:
+    unsigned char data[NOTIFICATION_RING_SIZE];
+    std::atomic<size_t> head { 0 }; // Total bytes written, only advanced by the producer
+    std::atomic<size_t> tail { 0 }; // Total bytes read, only advanced by the consumer
+    std::atomic<uint32_t> droppedNotifications { 0 };
+};
+
+#endif // NOTIFICATION_RING_H
\ No newline at end of file
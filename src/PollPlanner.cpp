@@ -0,0 +1,133 @@
+#include "PollPlanner.h"
+
+PollPlanner::PollPlanner(Scheduler& scheduler, const DeviceHealth& health) : scheduler(scheduler), health(health) {}
+
+int PollPlanner::pickDue(size_t deviceCount) {
+    refillCredit();
+
+    if (radioCredit <= 0) {
+        if (!budgetReported) {
+            budgetReported = true;
+            Serial.println("Radio budget used up, holding polls until it refills");
+        }
+
+        return -1;
+    }
+
+    budgetReported = false;
+
+    int picked = -1;
+    for (size_t i = 0; i < deviceCount && i < MAX_SCAN_DEVICES; i++) {
+        const DeviceSchedule& device = devices[i];
+        if (!device.due || device.active) {
+            continue;
+        }
+
+        if (
+            picked < 0 ||
+            device.priority > devices[picked].priority ||
+            (device.priority == devices[picked].priority && (long) (device.dueSince - devices[picked].dueSince) < 0)
+        ) {
+            picked = i;
+        }
+    }
+
+    return picked;
+}
+
+void PollPlanner::onSessionStarted(int device) {
+    devices[device].due = false;
+    devices[device].active = true;
+    devices[device].sessionStart = millis();
+}
+
+void PollPlanner::onSessionEnded(int device, const CellInfo* cellInfo) {
+    DeviceSchedule& schedule = devices[device];
+    schedule.active = false;
+
+    refillCredit();
+    radioCredit -= millis() - schedule.sessionStart;
+
+    if (cellInfo) {
+        schedule.priority = classify(schedule, *cellInfo);
+        schedule.lastPercentRemaining = cellInfo->percent_remaining;
+    } else {
+        schedule.priority = POLL_PRIORITY_NORMAL;
+    }
+
+    unsigned long interval = cellInfo ? intervalFor(schedule.priority) : health.getRetryDelay(device, intervalFor(schedule.priority));
+    Serial.printf("BMS device %d next poll in %lu s (priority %d)\n", device + 1, interval / 1000, schedule.priority);
+
+    if (!scheduler.schedule(interval, markDue, &schedule)) {
+        markDue(&schedule); // Better early than never
+    }
+}
+
+PollPriority PollPlanner::getPriority(int device) const {
+    return devices[device].priority;
+}
+
+long PollPlanner::getRadioCredit() const {
+    return radioCredit;
+}
+
+void PollPlanner::refillCredit() {
+    unsigned long now = millis();
+    unsigned long elapsed = now - lastRefill;
+
+    if (elapsed >= RADIO_BUDGET_WINDOW) {
+        radioCredit = RADIO_BUDGET;
+        lastRefill = now;
+        return;
+    }
+
+    long refill = (long) ((uint64_t) elapsed * RADIO_BUDGET / RADIO_BUDGET_WINDOW);
+    if (refill == 0) {
+        return; // Keep the remainder until it adds up to a whole ms
+    }
+
+    radioCredit = radioCredit + refill > RADIO_BUDGET ? RADIO_BUDGET : radioCredit + refill;
+    lastRefill = now;
+}
+
+PollPriority PollPlanner::classify(const DeviceSchedule& device, const CellInfo& cellInfo) const {
+    // Values are the raw integers from the BMS - current in mA
+    int32_t current = cellInfo.battery_current < 0 ? -cellInfo.battery_current : cellInfo.battery_current;
+
+    if (cellInfo.alarm_bits != 0) {
+        return POLL_PRIORITY_ALERT;
+    }
+
+    if (
+        current >= POLL_ACTIVE_CURRENT ||
+        cellInfo.percent_remaining <= POLL_LOW_PERCENT ||
+        cellInfo.percent_remaining >= POLL_HIGH_PERCENT
+    ) {
+        return POLL_PRIORITY_ACTIVE;
+    }
+
+    if (current <= POLL_IDLE_CURRENT && cellInfo.percent_remaining == device.lastPercentRemaining) {
+        return POLL_PRIORITY_IDLE;
+    }
+
+    return POLL_PRIORITY_NORMAL;
+}
+
+unsigned long PollPlanner::intervalFor(PollPriority priority) {
+    switch (priority) {
+        case POLL_PRIORITY_ALERT:
+            return POLL_INTERVAL_ALERT;
+        case POLL_PRIORITY_ACTIVE:
+            return POLL_INTERVAL_ACTIVE;
+        case POLL_PRIORITY_IDLE:
+            return POLL_INTERVAL_IDLE;
+        default:
+            return POLL_INTERVAL_NORMAL;
+    }
+}
+
+void PollPlanner::markDue(void* context) {
+    DeviceSchedule* device = (DeviceSchedule*) context;
+    device->due = true;
+    device->dueSince = millis();
+}
\ No newline at end of file
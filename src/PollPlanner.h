@@ -0,0 +1,56 @@
+#ifndef POLL_PLANNER_H
+#define POLL_PLANNER_H
+
+#include "constants.h"
+#include "models/constants.h"
+#include "models/cell_info.h"
+#include "Scheduler.h"
+#include "DeviceHealth.h"
+
+enum PollPriority {
+    POLL_PRIORITY_IDLE, // No current to speak of and nothing changing
+    POLL_PRIORITY_NORMAL,
+    POLL_PRIORITY_ACTIVE, // High current, or state of charge near either end
+    POLL_PRIORITY_ALERT // Alarm bits set
+};
+
+// Decides when each BMS is polled next from what its last session brought back, so airtime goes
+// where the data is changing. Due devices are handed out by priority, then by how long they have waited,
+// while there is radio credit left - sessions spend it, and it refills at RADIO_BUDGET per RADIO_BUDGET_WINDOW.
+class PollPlanner {
+public:
+    PollPlanner(Scheduler& scheduler, const DeviceHealth& health);
+
+    // Most urgent device that is due, or -1 if there is none or the radio budget is used up
+    int pickDue(size_t deviceCount);
+    void onSessionStarted(int device);
+    // Plans the next poll - cellInfo is nullptr if the session brought nothing back, which backs off per DeviceHealth
+    void onSessionEnded(int device, const CellInfo* cellInfo);
+
+    PollPriority getPriority(int device) const;
+    long getRadioCredit() const;
+private:
+    struct DeviceSchedule {
+        bool due = true; // Every device is polled once at startup
+        bool active = false;
+        unsigned long dueSince = 0;
+        unsigned long sessionStart = 0;
+        PollPriority priority = POLL_PRIORITY_NORMAL;
+        int lastPercentRemaining = -1;
+    };
+
+    Scheduler& scheduler;
+    const DeviceHealth& health;
+    DeviceSchedule devices[MAX_SCAN_DEVICES];
+
+    long radioCredit = RADIO_BUDGET; // ms of session time, can go negative after a long session
+    unsigned long lastRefill = 0;
+    bool budgetReported = false;
+
+    void refillCredit();
+    PollPriority classify(const DeviceSchedule& device, const CellInfo& cellInfo) const;
+    static unsigned long intervalFor(PollPriority priority);
+    static void markDue(void* context);
+};
+
+#endif // POLL_PLANNER_H
\ No newline at end of file
@@ -0,0 +1,294 @@
+#include "SampleLog.h"
+#include "Config.h"
+#include "models/telemetry.h"
+
+#define SAMPLE_LOG_INDEX "/samples.idx"
+#define SAMPLE_LOG_PATH_LENGTH 24 // "/samples-" + 8 hex digits + ".log"
+
+// Record: u8 payload length, u8 crc8 of the payload, then the payload -
+// u8 device, u8 serial number length, the serial number and the sample in the telemetry format
+#define SAMPLE_LOG_RECORD_HEADER 2
+#define SAMPLE_LOG_RECORD_MAX (2 + 12 + TELEMETRY_SAMPLE_MAX_LENGTH)
+
+static_assert(SAMPLE_LOG_RECORD_MAX <= UINT8_MAX, "Sample log records no longer fit their length byte");
+
+static size_t encodeRecord(const BMSSample& sample, uint8_t* payload) {
+    TelemetryWriter out(payload, SAMPLE_LOG_RECORD_MAX);
+    uint8_t serialLength = strnlen(sample.serialNumber, 12);
+
+    out.put<uint8_t>(sample.device);
+    out.put<uint8_t>(serialLength);
+    out.putBytes((const uint8_t*) sample.serialNumber, serialLength);
+    encodeTelemetrySample(out, sample);
+    return out.length();
+}
+
+static bool decodeRecord(const uint8_t* payload, size_t length, BMSSample& sample) {
+    TelemetryReader in(payload, length);
+
+    uint8_t device = in.get<uint8_t>();
+    uint8_t serialLength = in.get<uint8_t>();
+    if (serialLength > 12) {
+        return false;
+    }
+
+    char serialNumber[13];
+    in.getBytes((uint8_t*) serialNumber, serialLength);
+    serialNumber[serialLength] = '\0';
+
+    if (!decodeTelemetrySample(in, sample) || in.remaining() != 0) {
+        return false;
+    }
+
+    sample.device = device;
+    strcpy(sample.serialNumber, serialNumber);
+    return true;
+}
+
+SampleLog& SampleLog::getInstance() {
+    static SampleLog instance;
+    return instance;
+}
+
+bool SampleLog::append(const BMSSample* samples, size_t count) {
+    load();
+
+    File file;
+    for (size_t i = 0; i < count; i++) {
+        uint8_t record[SAMPLE_LOG_RECORD_HEADER + SAMPLE_LOG_RECORD_MAX];
+        size_t length = encodeRecord(samples[i], record + SAMPLE_LOG_RECORD_HEADER);
+        record[0] = length;
+        record[1] = crc8(record + SAMPLE_LOG_RECORD_HEADER, length);
+        length += SAMPLE_LOG_RECORD_HEADER;
+
+        if (lastSegmentSize > 0 && lastSegmentSize + length > SAMPLE_LOG_SEGMENT_SIZE) {
+            if (file) {
+                file.close();
+            }
+            startSegment();
+        }
+
+        if (!file) {
+            char path[SAMPLE_LOG_PATH_LENGTH];
+            segmentPath(index.lastSegment, path);
+            file = LittleFS.open(path, "a");
+            if (!file) {
+                Serial.println("Failed to open sample log for writing");
+                return false;
+            }
+        }
+
+        if (file.write(record, length) != length) {
+            // Whatever part of the record made it is caught by load() after the next reboot
+            Serial.println("Failed to write sample log, is the filesystem full?");
+            file.close();
+            return false;
+        }
+
+        lastSegmentSize += length;
+        storedCount++;
+    }
+
+    if (file) {
+        file.close();
+    }
+
+    Serial.printf("Stored %zu samples in sample log segment %u\n", count, index.lastSegment);
+    return true;
+}
+
+size_t SampleLog::peek(BMSSample* samples, size_t capacity) {
+    load();
+
+    peekSegment = index.firstSegment;
+    peekOffset = index.readOffset;
+    peekCount = 0;
+
+    while (peekCount < capacity) {
+        size_t count = 0;
+        uint32_t size = 0;
+        peekOffset = readSegment(peekSegment, peekOffset, samples + peekCount, capacity - peekCount, count, size);
+        peekCount += count;
+
+        if (peekCount < capacity && peekOffset < size) {
+            // Nothing after a damaged record can be trusted to line up
+            Serial.printf("Skipping damaged records in sample log segment %u\n", peekSegment);
+            peekOffset = size;
+        }
+
+        if (peekOffset < size || peekSegment == index.lastSegment) {
+            break;
+        }
+
+        peekSegment++;
+        peekOffset = 0;
+    }
+
+    return peekCount;
+}
+
+void SampleLog::consume() {
+    load();
+
+    for (uint32_t segment = index.firstSegment; segment < peekSegment; segment++) {
+        removeSegment(segment);
+    }
+
+    index.firstSegment = peekSegment;
+    index.readOffset = peekOffset;
+    replayedCount += peekCount;
+    peekCount = 0;
+
+    if (isEmpty()) {
+        // Everything is sent - start over with an empty segment rather than keep appending to this one
+        removeSegment(index.lastSegment);
+        index.lastSegment++;
+        index.firstSegment = index.lastSegment;
+        index.readOffset = 0;
+        lastSegmentSize = 0;
+    }
+
+    saveIndex();
+}
+
+bool SampleLog::isEmpty() {
+    load();
+    return index.firstSegment == index.lastSegment && index.readOffset >= lastSegmentSize;
+}
+
+uint32_t SampleLog::getStoredCount() const {
+    return storedCount;
+}
+
+uint32_t SampleLog::getReplayedCount() const {
+    return replayedCount;
+}
+
+uint32_t SampleLog::getDroppedSegments() const {
+    return droppedSegments;
+}
+
+void SampleLog::load() {
+    if (loaded) {
+        return;
+    }
+
+    loaded = true;
+    Config::getInstance(); // Mounts LittleFS
+
+    bool readOK = false;
+    if (LittleFS.exists(SAMPLE_LOG_INDEX)) {
+        File indexFile = LittleFS.open(SAMPLE_LOG_INDEX, "r");
+        if (indexFile) {
+            readOK = indexFile.readBytes((char*) &index, sizeof(index)) == sizeof(index) &&
+                index.lastSegment - index.firstSegment < SAMPLE_LOG_SEGMENTS;
+            indexFile.close();
+        }
+    }
+
+    if (readOK && index.version != TELEMETRY_VERSION) {
+        Serial.println("Sample log was written by another firmware version, discarding it");
+        for (uint32_t segment = index.firstSegment; segment <= index.lastSegment; segment++) {
+            removeSegment(segment);
+        }
+        readOK = false;
+    }
+
+    if (!readOK) {
+        index = {};
+        index.version = TELEMETRY_VERSION;
+        removeSegment(0); // Left over from a lost index, so it is not appended to
+        saveIndex();
+        return;
+    }
+
+    // A reboot while appending can leave part of a record at the end - continue in a new segment after the good ones
+    size_t count = 0;
+    uint32_t size = 0;
+    lastSegmentSize = readSegment(index.lastSegment, 0, nullptr, SIZE_MAX, count, size);
+    if (lastSegmentSize < size) {
+        Serial.printf("Sample log segment %u ends in a partial record\n", index.lastSegment);
+        startSegment();
+    }
+
+    Serial.printf("Sample log has segments %u to %u\n", index.firstSegment, index.lastSegment);
+}
+
+void SampleLog::saveIndex() {
+    File indexFile = LittleFS.open(SAMPLE_LOG_INDEX, "w");
+    if (indexFile) {
+        indexFile.write((const uint8_t*) &index, sizeof(index));
+        indexFile.close();
+    } else {
+        Serial.println("Failed to open sample log index for writing");
+    }
+}
+
+void SampleLog::startSegment() {
+    index.lastSegment++;
+    lastSegmentSize = 0;
+
+    while (index.lastSegment - index.firstSegment >= SAMPLE_LOG_SEGMENTS) {
+        Serial.printf("Sample log is full, dropping segment %u\n", index.firstSegment);
+        removeSegment(index.firstSegment);
+        index.firstSegment++;
+        index.readOffset = 0;
+        droppedSegments++;
+    }
+
+    saveIndex();
+}
+
+void SampleLog::removeSegment(uint32_t segment) {
+    char path[SAMPLE_LOG_PATH_LENGTH];
+    segmentPath(segment, path);
+    if (LittleFS.exists(path)) {
+        LittleFS.remove(path);
+    }
+}
+
+uint32_t SampleLog::readSegment(uint32_t segment, uint32_t offset, BMSSample* samples, size_t capacity, size_t& count, uint32_t& size) {
+    count = 0;
+    size = 0;
+
+    char path[SAMPLE_LOG_PATH_LENGTH];
+    segmentPath(segment, path);
+    if (!LittleFS.exists(path)) {
+        return 0;
+    }
+
+    File file = LittleFS.open(path, "r");
+    if (!file) {
+        return 0;
+    }
+
+    size = file.size();
+    file.seek(offset);
+
+    while (count < capacity && offset + SAMPLE_LOG_RECORD_HEADER <= size) {
+        uint8_t header[SAMPLE_LOG_RECORD_HEADER];
+        uint8_t payload[SAMPLE_LOG_RECORD_MAX];
+
+        if (file.read(header, sizeof(header)) != sizeof(header) || header[0] > sizeof(payload) || offset + sizeof(header) + header[0] > size) {
+            break;
+        }
+
+        if (file.read(payload, header[0]) != header[0] || crc8(payload, header[0]) != header[1]) {
+            break;
+        }
+
+        if (samples && !decodeRecord(payload, header[0], samples[count])) {
+            break;
+        }
+
+        offset += sizeof(header) + header[0];
+        count++;
+    }
+
+    file.close();
+    return offset;
+}
+
+void SampleLog::segmentPath(uint32_t segment, char* path) {
+    snprintf(path, SAMPLE_LOG_PATH_LENGTH, "/samples-%08X.log", (unsigned int) segment);
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+#ifndef SAMPLE_LOG_H
+#define SAMPLE_LOG_H
+
+#include "constants.h"
+#include "models/sample.h"
+
+#include <atomic>
+
+// Samples that could not be uploaded, kept on LittleFS until they can be - only used with SAMPLE_LOG.
+// An append-only log of numbered segment files: records go to the newest segment, a full one is left as it is and the next
+// number started, and replay reads from the oldest. Segments are deleted whole once sent and never rewritten, so the only
+// file written in place is the small index. Past SAMPLE_LOG_SEGMENTS the oldest segment is dropped, sent or not.
+class SampleLog {
+public:
+    static SampleLog& getInstance();
+
+    // False if the samples could not be written
+    bool append(const BMSSample* samples, size_t count);
+    // The oldest samples not sent yet, up to capacity - they stay in the log until consume()
+    size_t peek(BMSSample* samples, size_t capacity);
+    // Marks what the last peek() returned as sent, along with any damaged records it skipped
+    void consume();
+    bool isEmpty();
+
+    // Safe from any task
+    uint32_t getStoredCount() const;
+    uint32_t getReplayedCount() const;
+    uint32_t getDroppedSegments() const;
+private:
+    // Persisted as SAMPLE_LOG_INDEX
+    struct Index {
+        uint8_t version; // TELEMETRY_VERSION the records were written with
+        uint32_t firstSegment; // Oldest segment, read from readOffset
+        uint32_t lastSegment; // Newest segment, appended to
+        uint32_t readOffset;
+    };
+
+    Index index = {};
+    uint32_t lastSegmentSize = 0;
+    bool loaded = false;
+
+    // Where the last peek() stopped
+    uint32_t peekSegment = 0;
+    uint32_t peekOffset = 0;
+    size_t peekCount = 0;
+
+    std::atomic<uint32_t> storedCount { 0 };
+    std::atomic<uint32_t> replayedCount { 0 };
+    std::atomic<uint32_t> droppedSegments { 0 };
+
+    void load();
+    void saveIndex();
+    // Closes the newest segment, dropping the oldest when over budget
+    void startSegment();
+    void removeSegment(uint32_t segment);
+    // Decodes records from offset until capacity samples are read or a record does not check out - samples can be null
+    // to only check them. Returns the offset after the last good record, size is set to the length of the segment.
+    uint32_t readSegment(uint32_t segment, uint32_t offset, BMSSample* samples, size_t capacity, size_t& count, uint32_t& size);
+    static void segmentPath(uint32_t segment, char* path);
+};
+
+#endif // SAMPLE_LOG_H
\ No newline at end of file
@@ -0,0 +1,56 @@
+#include "SampleQueue.h"
+
+#ifdef ESP32
+
+bool SampleQueue::begin(size_t length) {
+    queue = xQueueCreate(length, sizeof(BMSSample));
+    if (!queue) {
+        Serial.println("Failed to create sample queue");
+        return false;
+    }
+
+    return true;
+}
+
+void SampleQueue::push(const BMSSample& sample) {
+    if (!queue) {
+        dropped++;
+        return;
+    }
+
+    // The newest reading is worth more than the oldest one still waiting
+    while (xQueueSend(queue, &sample, 0) != pdTRUE) {
+        if (xQueueReceive(queue, &evicted, 0) == pdTRUE) {
+            dropped++;
+        }
+    }
+
+    queued++;
+
+    uint32_t depth = uxQueueMessagesWaiting(queue);
+    if (depth > maxDepth) {
+        maxDepth = depth;
+    }
+}
+
+bool SampleQueue::pop(BMSSample& sample, TickType_t timeout) {
+    return queue && xQueueReceive(queue, &sample, timeout) == pdTRUE;
+}
+
+size_t SampleQueue::pending() const {
+    return queue ? uxQueueMessagesWaiting(queue) : 0;
+}
+
+uint32_t SampleQueue::getQueued() const {
+    return queued;
+}
+
+uint32_t SampleQueue::getDropped() const {
+    return dropped;
+}
+
+uint32_t SampleQueue::getMaxDepth() const {
+    return maxDepth;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef SAMPLE_QUEUE_H
+#define SAMPLE_QUEUE_H
+
+#ifdef ESP32
+
+#include "constants.h"
+#include "models/sample.h"
+
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+// Bounded FreeRTOS queue of parsed samples between the acquisition task and the uploader.
+// Acquisition never waits on it - when the uploader falls behind, the oldest sample makes room and is counted as dropped.
+class SampleQueue {
+public:
+    bool begin(size_t length = SAMPLE_QUEUE_LENGTH);
+
+    // Producer side, never blocks
+    void push(const BMSSample& sample);
+    // Consumer side - waits up to timeout for a sample
+    bool pop(BMSSample& sample, TickType_t timeout);
+
+    // Safe from any task
+    size_t pending() const;
+    uint32_t getQueued() const;
+    uint32_t getDropped() const;
+    uint32_t getMaxDepth() const;
+private:
+    QueueHandle_t queue = nullptr;
+    BMSSample evicted; // Only touched by the producer
+
+    std::atomic<uint32_t> queued { 0 };
+    std::atomic<uint32_t> dropped { 0 };
+    std::atomic<uint32_t> maxDepth { 0 };
+};
+
+#endif
+
+#endif // SAMPLE_QUEUE_H
\ No newline at end of file
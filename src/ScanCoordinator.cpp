@@ -0,0 +1,184 @@
+#include "ScanCoordinator.h"
+
+static_assert(MAX_SCAN_DEVICES <= 32, "seenThisScan has one bit per device");
+
+ScanCoordinator& ScanCoordinator::getInstance() {
+    // Devices register from global constructors, so this has to exist before any of them run
+    static ScanCoordinator instance;
+    return instance;
+}
+
+int ScanCoordinator::addDevice(const uint8_t* address) {
+    for (size_t i = 0; i < deviceCount; i++) {
+        if (memcmp(devices[i].address, address, sizeof(devices[i].address)) == 0) {
+            return i;
+        }
+    }
+
+    if (deviceCount >= MAX_SCAN_DEVICES) {
+        return -1;
+    }
+
+    memcpy(devices[deviceCount].address, address, sizeof(devices[deviceCount].address));
+    return deviceCount++;
+}
+
+const ScanSighting* ScanCoordinator::getSighting(int slot) const {
+    if (slot < 0 || (size_t) slot >= deviceCount) {
+        return nullptr;
+    }
+
+    return &devices[slot];
+}
+
+bool ScanCoordinator::isFresh(int slot, unsigned long maxAge) const {
+    const ScanSighting* sighting = getSighting(slot);
+    return sighting && sighting->lastSeen && millis() - sighting->lastSeen < maxAge;
+}
+
+void ScanCoordinator::forget(int slot) {
+    if (slot >= 0 && (size_t) slot < deviceCount) {
+        devices[slot].lastSeen = 0;
+    }
+}
+
+bool ScanCoordinator::isScanning() const {
+    return scanning;
+}
+
+void ScanCoordinator::recordSighting(const uint8_t* address, uint8_t addressType, int8_t rssi) {
+    for (size_t i = 0; i < deviceCount; i++) {
+        if (memcmp(devices[i].address, address, sizeof(devices[i].address)) != 0) {
+            continue;
+        }
+
+        devices[i].addressType = addressType;
+        devices[i].rssi = rssi;
+        devices[i].lastSeen = millis();
+
+#ifdef JKBMS_DEBUG
+        if (!(seenThisScan & (1UL << i))) {
+            Serial.printf("Found device %d, RSSI %d\n", i, rssi);
+        }
+#endif
+        seenThisScan |= 1UL << i;
+        break;
+    }
+
+    // No need to keep listening once every device has been heard from
+    if (scanning && seenThisScan == (1UL << deviceCount) - 1) {
+        stopScan();
+    }
+}
+
+#ifdef ESP32
+void ScanCoordinator::begin() {
+    bleScan = NimBLEDevice::getScan();
+    bleScan->setInterval(SCAN_INTERVAL);
+    bleScan->setWindow(SCAN_WINDOW);
+    bleScan->setActiveScan(false); // Only the address is needed, no scan responses
+    bleScan->setMaxResults(0); // Sightings are kept here instead
+    bleScan->setScanCallbacks(this, false);
+
+    // Let the controller drop everyone else's adverts. The address type of a device is only known once it has been seen,
+    // so each address goes in as both - if the list runs out of room, scan everything and match the addresses here.
+    useFilterList = true;
+    for (size_t i = 0; i < deviceCount; i++) {
+        useFilterList &= NimBLEDevice::whiteListAdd(NimBLEAddress(devices[i].address, BLE_ADDR_PUBLIC));
+        useFilterList &= NimBLEDevice::whiteListAdd(NimBLEAddress(devices[i].address, BLE_ADDR_RANDOM));
+    }
+
+    if (!useFilterList) {
+        Serial.println("Filter accept list is full, scanning without it");
+    }
+
+    bleScan->setFilterPolicy(useFilterList ? BLE_HCI_SCAN_FILT_USE_WL : BLE_HCI_SCAN_FILT_NO_WL);
+}
+
+void ScanCoordinator::requestScan() {
+    if (scanning || !bleScan) {
+        return;
+    }
+
+    scanning = true;
+    scanStart = millis();
+    seenThisScan = 0;
+
+    if (!bleScan->start(SCAN_TIME, false)) {
+        Serial.println("Failed to start scan");
+        scanning = false;
+    }
+}
+
+void ScanCoordinator::poll() {
+    // NimBLE ends the scan by itself after SCAN_TIME
+}
+
+void ScanCoordinator::stopScan() {
+    // Stopping by hand does not call onScanEnd
+    bleScan->stop();
+    scanning = false;
+}
+
+void ScanCoordinator::onResult(const NimBLEAdvertisedDevice* advertisedDevice) {
+    const NimBLEAddress& address = advertisedDevice->getAddress();
+    recordSighting(address.getVal(), address.getType(), advertisedDevice->getRSSI());
+}
+
+void ScanCoordinator::onScanEnd(const NimBLEScanResults& results, int reason) {
+    Serial.println("Scan ended");
+    scanning = false;
+}
+#endif
+
+#ifdef ARDUINO_ARCH_RP2040
+void ScanCoordinator::begin() {
+    // Let the controller drop everyone else's adverts. The address type of a device is only known once it has been seen,
+    // so each address goes in as both - if the list runs out of room, scan everything and match the addresses here.
+    useFilterList = true;
+    for (size_t i = 0; i < deviceCount; i++) {
+        useFilterList &= gap_whitelist_add(BD_ADDR_TYPE_LE_PUBLIC, devices[i].address) == ERROR_CODE_SUCCESS;
+        useFilterList &= gap_whitelist_add(BD_ADDR_TYPE_LE_RANDOM, devices[i].address) == ERROR_CODE_SUCCESS;
+    }
+
+    if (!useFilterList) {
+        Serial.println("Filter accept list is full, scanning without it");
+    }
+}
+
+void ScanCoordinator::requestScan() {
+    if (scanning) {
+        return;
+    }
+
+    scanning = true;
+    scanStart = millis();
+    seenThisScan = 0;
+
+    // Passive scan, filter accept list only when all the addresses made it in
+    gap_set_scan_params(0, 48, 48, useFilterList ? 1 : 0);
+    gap_start_scan();
+}
+
+void ScanCoordinator::poll() {
+    if (scanning && millis() - scanStart > SCAN_TIME) {
+        Serial.println("Scan ended");
+        stopScan();
+    }
+}
+
+void ScanCoordinator::stopScan() {
+    gap_stop_scan();
+    scanning = false;
+}
+
+void ScanCoordinator::handleAdvertisingReport(const uint8_t* packet) {
+    if (!scanning) {
+        return;
+    }
+
+    bd_addr_t address;
+    gap_event_advertising_report_get_address(packet, address);
+    recordSighting(address, gap_event_advertising_report_get_address_type(packet), gap_event_advertising_report_get_rssi(packet));
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,70 @@
+#ifndef SCAN_COORDINATOR_H
+#define SCAN_COORDINATOR_H
+
+#include "models/constants.h"
+
+#include <atomic>
+
+#ifdef ESP32
+#include <NimBLEDevice.h>
+#endif
+#ifdef ARDUINO_ARCH_RP2040
+#include <btstack.h>
+#endif
+
+struct ScanSighting {
+    uint8_t address[6]; // In the byte order of the BLE stack
+    uint8_t addressType = 0;
+    int8_t rssi = 0;
+    unsigned long lastSeen = 0; // 0 until the device shows up in a scan
+};
+
+// One scan for every configured BMS - adverts are matched against all addresses at once,
+// and each device's address type and last sighting are kept so a connect can skip scanning
+class ScanCoordinator
+#ifdef ESP32
+    : public NimBLEScanCallbacks
+#endif
+{
+public:
+    static ScanCoordinator& getInstance();
+
+    // Returns the slot for the address, or -1 if there is no room left
+    int addDevice(const uint8_t* address);
+    // Once the BLE stack is up - loads the addresses into the controller's filter accept list
+    void begin();
+
+    void requestScan();
+    // Ends the scan once its time is up or everyone has been seen
+    void poll();
+    bool isScanning() const;
+
+    const ScanSighting* getSighting(int slot) const;
+    bool isFresh(int slot, unsigned long maxAge = SCAN_CACHE_TIME) const;
+    // Drops a sighting that turned out to be stale, e.g. after a failed connect
+    void forget(int slot);
+
+#ifdef ARDUINO_ARCH_RP2040
+    void handleAdvertisingReport(const uint8_t* packet);
+#endif
+private:
+    ScanSighting devices[MAX_SCAN_DEVICES];
+    size_t deviceCount = 0;
+
+    std::atomic<bool> scanning { false };
+    unsigned long scanStart = 0;
+    uint32_t seenThisScan = 0; // Bit per slot
+    bool useFilterList = false; // Every address is in the controller's filter accept list, as public and as random
+
+    void recordSighting(const uint8_t* address, uint8_t addressType, int8_t rssi);
+    void stopScan();
+
+#ifdef ESP32
+    NimBLEScan* bleScan = nullptr;
+
+    void onResult(const NimBLEAdvertisedDevice* advertisedDevice) override;
+    void onScanEnd(const NimBLEScanResults& results, int reason) override;
+#endif
+};
+
+#endif // SCAN_COORDINATOR_H
\ No newline at end of file
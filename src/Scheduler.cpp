@@ -0,0 +1,118 @@
+#include "Scheduler.h"
+
+uint32_t Scheduler::schedule(unsigned long delay, Callback callback, void* context) {
+    if (count >= MAX_SCHEDULED_TIMERS || !callback) {
+        Serial.println("Scheduler full, timer not set");
+        return 0;
+    }
+
+    uint32_t id = nextId++;
+    if (nextId == 0) {
+        nextId = 1; // 0 is reserved for failure
+    }
+
+    timers[count] = { millis() + delay, id, callback, context };
+    siftUp(count++);
+    return id;
+}
+
+bool Scheduler::cancel(uint32_t id) {
+    for (size_t i = 0; i < count; i++) {
+        if (timers[i].id == id) {
+            removeAt(i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool Scheduler::isPending(uint32_t id) const {
+    for (size_t i = 0; i < count; i++) {
+        if (timers[i].id == id) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Scheduler::run() {
+    // Only what was due on entry, so a callback that reschedules itself with no delay cannot keep us here
+    unsigned long now = millis();
+    size_t budget = count;
+
+    while (count > 0 && budget-- > 0 && (long) (now - timers[0].due) >= 0) {
+        Timer timer = timers[0];
+        removeAt(0);
+        timer.callback(timer.context);
+    }
+}
+
+unsigned long Scheduler::timeUntilNext(unsigned long maxWait) const {
+    if (count == 0) {
+        return maxWait;
+    }
+
+    long remaining = (long) (timers[0].due - millis());
+    if (remaining <= 0) {
+        return 0;
+    }
+
+    return (unsigned long) remaining < maxWait ? remaining : maxWait;
+}
+
+bool Scheduler::isBefore(const Timer& a, const Timer& b) {
+    // Works across millis() wrapping around
+    return (long) (a.due - b.due) < 0;
+}
+
+void Scheduler::siftUp(size_t index) {
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (!isBefore(timers[index], timers[parent])) {
+            break;
+        }
+
+        Timer swap = timers[index];
+        timers[index] = timers[parent];
+        timers[parent] = swap;
+        index = parent;
+    }
+}
+
+void Scheduler::siftDown(size_t index) {
+    for (;;) {
+        size_t earliest = index;
+        size_t left = index * 2 + 1;
+        size_t right = left + 1;
+
+        if (left < count && isBefore(timers[left], timers[earliest])) {
+            earliest = left;
+        }
+
+        if (right < count && isBefore(timers[right], timers[earliest])) {
+            earliest = right;
+        }
+
+        if (earliest == index) {
+            break;
+        }
+
+        Timer swap = timers[index];
+        timers[index] = timers[earliest];
+        timers[earliest] = swap;
+        index = earliest;
+    }
+}
+
+void Scheduler::removeAt(size_t index) {
+    count--;
+    if (index == count) {
+        return;
+    }
+
+    timers[index] = timers[count];
+    siftDown(index);
+    siftUp(index);
+}
\ No newline at end of file
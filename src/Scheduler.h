@@ -0,0 +1,39 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "models/constants.h"
+
+// Timers kept in a min-heap by deadline and run from the owning loop, so a wait becomes a continuation
+// instead of a blocking delay. Not thread-safe - schedule, cancel and run from the same task.
+class Scheduler {
+public:
+    typedef void (*Callback)(void* context);
+
+    // Runs callback once, delay ms from now. Returns an id for cancel(), or 0 if every timer is taken
+    uint32_t schedule(unsigned long delay, Callback callback, void* context = nullptr);
+    bool cancel(uint32_t id);
+    bool isPending(uint32_t id) const;
+
+    // Runs every callback that is due - callbacks may schedule again
+    void run();
+    // Time until the next deadline, at most maxWait
+    unsigned long timeUntilNext(unsigned long maxWait) const;
+private:
+    struct Timer {
+        unsigned long due;
+        uint32_t id;
+        Callback callback;
+        void* context;
+    };
+
+    Timer timers[MAX_SCHEDULED_TIMERS];
+    size_t count = 0;
+    uint32_t nextId = 1;
+
+    static bool isBefore(const Timer& a, const Timer& b);
+    void siftUp(size_t index);
+    void siftDown(size_t index);
+    void removeAt(size_t index);
+};
+
+#endif // SCHEDULER_H
\ No newline at end of file
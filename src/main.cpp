@@ -4,27 +4,43 @@
 #ifdef ESP32
 #include <esp_task_wdt.h>
 #endif
-unsigned long startupTime = 0;
+// Last time a BMS session ended or none was running - written by the acquisition task on ESP32
+volatile unsigned long lastProgressTime = 0;
 
 // Bluetooth
 #include "JKBMS.h"
 JKBMS bmsDevices[] = {
-    JKBMS("C8:47:80:20:2E:B3"),
-    JKBMS("98:DA:10:07:AC:56"),
-    JKBMS("C8:47:80:21:72:6D"),
-    JKBMS("C8:47:80:3A:22:F3")
+    { "C8:47:80:20:2E:B3" },
+    { "98:DA:10:07:AC:56" },
+    { "C8:47:80:21:72:6D" },
+    { "C8:47:80:3A:22:F3" }
 };
 
 #define NUM_BMS_DEVICES (sizeof(bmsDevices) / sizeof(bmsDevices[0]))
 
+// Timers for the BMS checks - driven by loop() on RP2040 and by the acquisition task on ESP32
+#include "Scheduler.h"
+Scheduler scheduler;
+
+// Session outcomes and backoff per device
+#include "DeviceHealth.h"
+DeviceHealth bmsHealth;
+
 // WiFi
 #ifdef USE_WIFI
 #include "ChartClient.h"
 ChartClient chartClient;
 #endif
 
-// Config
-#include "Config.h"
+#ifdef ESP32
+// Tasks
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#ifdef USE_WIFI
+#include "SampleQueue.h"
+SampleQueue sampleQueue;
+#endif
+#endif
 
 #ifdef USE_TOUCH
 // Touchscreen and display
@@ -47,8 +63,14 @@ void turnOffLEDs();
 
 void feedWatchdog();
 void resetDevice();
-void delaySafe(unsigned long ms);
 void checkJKBMS();
+void submitSample(int device);
+#ifdef ESP32
+void acquisitionTask(void* parameter);
+void uploadTask(void* parameter);
+void uiTask(void* parameter);
+void reportPipeline();
+#endif
 
 void setup() {
     Serial.begin(115200);
@@ -84,7 +106,7 @@ void setup() {
             break;
     }
 #endif
-    startupTime = millis();
+    lastProgressTime = millis();
 
 #ifdef USE_TOUCH
     // Initialise the display
@@ -106,46 +128,63 @@ void setup() {
 #endif
 
     JKBMS::init();
-}
 
-void loop() {
+#ifdef PERSISTENT_BMS
+    for (int i = 0; i < NUM_BMS_DEVICES; i++) {
+        bmsDevices[i].setPersistent(true);
+    }
+#endif
+
+#ifdef ESP32
+    // BLE acquisition keeps running at full rate while an upload or a redraw is blocked
+    xTaskCreatePinnedToCore(acquisitionTask, "acquisition", TASK_STACK_SIZE, nullptr, ACQUISITION_TASK_PRIORITY, nullptr, ACQUISITION_TASK_CORE);
+#ifdef USE_WIFI
+    sampleQueue.begin();
+    xTaskCreatePinnedToCore(uploadTask, "upload", TASK_STACK_SIZE, nullptr, UPLOAD_TASK_PRIORITY, nullptr, UPLOAD_TASK_CORE);
+#endif
 #ifdef USE_TOUCH
-    checkTouchScreen();
-    renderJKBMS();
+    xTaskCreatePinnedToCore(uiTask, "ui", TASK_STACK_SIZE, nullptr, UI_TASK_PRIORITY, nullptr, UI_TASK_CORE);
+#endif
 #endif
+}
 
+void loop() {
     // Feed the watchdog
     feedWatchdog();
 
+#ifdef ESP32
+    // Acquisition, upload and UI have their own tasks - the loop only supervises them
+    reportPipeline();
+    vTaskDelay(pdMS_TO_TICKS(1000));
+#else
+    scheduler.run();
+
 #ifdef USE_WIFI
     chartClient.monitor();
 #endif // USE_WIFI
 
-#if defined(ARDUINO_ARCH_RP2040) and defined(USE_WIFI)
+#if defined(ARDUINO_ARCH_RP2040) and defined(USE_WIFI) and !defined(SAMPLE_LOG)
 
-    if (!WiFi.isConnected()) {
-        Serial.println("WiFi not connected, skipping BMS check");
-        delaySafe(1000);
-    } else {
+    // ChartClient reports the WiFi going up or down, keep looping until it is back
+    if (WiFi.isConnected()) {
         checkJKBMS();
     }
 
 #else
-    // Check as normal.
+    // Check as normal - with SAMPLE_LOG, samples taken without WiFi are stored until it is back
     checkJKBMS();
 #endif // ARDUINO_ARCH_RP2040
 
-    if (millis() - startupTime > EXECUTION_TIMEOUT) {
-        Serial.println("Execution timeout reached");
-
-#ifdef ARDUINO_ARCH_RP2040
-        Config& config = Config::getInstance();
-        config.lastBMSChecked += 1;
-        Config::save();
-#endif
+#endif // ESP32
 
+#ifndef PERSISTENT_BMS
+    // Only a session that never ends counts as a hang, rebooting on a timer would also wipe the device backoff.
+    // Streaming connections are only dropped on link loss, the watchdog still catches hangs
+    if (millis() - lastProgressTime > EXECUTION_TIMEOUT) {
+        Serial.println("Execution timeout reached, no BMS session has ended");
         resetDevice();
     }
+#endif
 }
 
 void resetDevice() {
@@ -166,13 +205,96 @@ void feedWatchdog() {
 #endif
 }
 
-void delaySafe(unsigned long ms) {
-    unsigned long start = millis();
-    while (millis() - start < ms) {
+// Hands the device's latest readings to the uploader
+void submitSample(int device) {
+#ifdef USE_WIFI
+    BMSSample sample;
+    if (!ChartClient::makeSample(bmsDevices[device].getNotificationBuffer(), sample)) {
+        return;
+    }
+
+    sample.device = device;
+    bmsDevices[device].getAddress(sample.address);
+
+#ifdef ESP32
+    sampleQueue.push(sample);
+#else
+    chartClient.addSample(sample);
+#endif
+#endif
+}
+
+#ifdef ESP32
+void acquisitionTask(void* parameter) {
+    esp_task_wdt_add(NULL);
+
+    for (;;) {
+        feedWatchdog();
+        scheduler.run();
+        checkJKBMS();
+        // Let the other tasks on this core run - notifications keep queueing in the meantime
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+#ifdef USE_WIFI
+void uploadTask(void* parameter) {
+    esp_task_wdt_add(NULL);
+    BMSSample sample;
+
+    for (;;) {
         feedWatchdog();
-        delay(10);
+        chartClient.monitor();
+
+#ifndef SAMPLE_LOG
+        // Without WiFi samples stay queued, the oldest are dropped once the queue is full
+        if (!chartClient.isReady()) {
+            vTaskDelay(pdMS_TO_TICKS(500));
+            continue;
+        }
+#endif
+
+        // Batched until enough samples are waiting or the oldest is too old - monitor() sends old ones.
+        // With SAMPLE_LOG a batch flushed without WiFi goes to the log, to be replayed once it is back
+        if (sampleQueue.pop(sample, pdMS_TO_TICKS(1000))) {
+            chartClient.addSample(sample);
+        }
+    }
+}
+#endif
+
+#ifdef USE_TOUCH
+void uiTask(void* parameter) {
+    esp_task_wdt_add(NULL);
+
+    for (;;) {
+        feedWatchdog();
+        checkTouchScreen();
+        renderJKBMS();
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+#endif
+
+unsigned long lastPipelineReport = 0;
+void reportPipeline() {
+#ifdef USE_WIFI
+    if (millis() - lastPipelineReport < PIPELINE_REPORT_INTERVAL) {
+        return;
     }
+
+    lastPipelineReport = millis();
+    Serial.printf("Samples: %u queued, %zu waiting (at most %u), %u dropped, %u sent, %u failed\n",
+        sampleQueue.getQueued(), sampleQueue.pending(), sampleQueue.getMaxDepth(), sampleQueue.getDropped(),
+        chartClient.getSentCount(), chartClient.getFailedCount());
+#ifdef SAMPLE_LOG
+    SampleLog& sampleLog = SampleLog::getInstance();
+    Serial.printf("Sample log: %u stored, %u replayed, %u segments dropped\n",
+        sampleLog.getStoredCount(), sampleLog.getReplayedCount(), sampleLog.getDroppedSegments());
+#endif
+#endif
 }
+#endif
 
 #ifdef USE_TOUCH
 unsigned long lastTouchTime = 0;
@@ -201,9 +323,15 @@ void renderJKBMS() {
     tft.fillScreen(TFT_BLACK);
 
     for (int i = 0; i < NUM_BMS_DEVICES; i++) {
-        sprintf(statusBuffer, "BMS %d: %s", i + 1, (bmsDevices[i].isRunning() ? (bmsDevices[i].getCellInfo() ? "Data Received" : "Loading") : "Disconnected"));
+        const DeviceHealthStats& health = bmsHealth.getStats(i);
 
-        if (bmsDevices[i].getCellInfo()) {
+        if (!bmsDevices[i].isRunning() && health.consecutiveFailures) {
+            sprintf(statusBuffer, "BMS %d: Unreachable (%s, %u in a row)", i + 1, getFailureName(health.lastFailure), health.consecutiveFailures);
+        } else {
+            sprintf(statusBuffer, "BMS %d: %s", i + 1, (bmsDevices[i].isRunning() ? (bmsDevices[i].hasCellInfo() ? "Data Received" : "Loading") : "Disconnected"));
+        }
+
+        if (bmsDevices[i].hasCellInfo()) {
             tft.setTextColor(TFT_GREEN);
         } else if (bmsDevices[i].isRunning()) {
             tft.setTextColor(TFT_YELLOW);
@@ -213,91 +341,165 @@ void renderJKBMS() {
 
         tft.drawString(statusBuffer, 0, i * 20);
     }
+
+#if defined(ESP32) && defined(USE_WIFI)
+    sprintf(statusBuffer, "Upload: %zu waiting, %u dropped, %u failed", sampleQueue.pending(), sampleQueue.getDropped(), chartClient.getFailedCount());
+    tft.setTextColor(sampleQueue.getDropped() ? TFT_YELLOW : TFT_WHITE);
+    tft.drawString(statusBuffer, 0, NUM_BMS_DEVICES * 20);
+#endif
 }
 #endif
 
-#ifdef ESP32
-size_t bmsIndex = 0;
+#ifdef PERSISTENT_BMS
+bool bmsLinked[NUM_BMS_DEVICES] = {}; // Connect started and not accounted for yet
+bool bmsStreamed[NUM_BMS_DEVICES] = {}; // At least one sample taken on the current link
+unsigned long linkStart[NUM_BMS_DEVICES] = {};
+unsigned long lastLinkEnd[NUM_BMS_DEVICES] = {};
+
+// Not connected and not backing off
+bool isWaitingForLink(int i) {
+    return !bmsDevices[i].isRunning() && !(lastLinkEnd[i] && millis() - lastLinkEnd[i] < bmsHealth.getRetryDelay(i, RECONNECT_DELAY));
+}
+
 void checkJKBMS() {
+    size_t running = 0;
+
     for (int i = 0; i < NUM_BMS_DEVICES; i++) {
-        if (bmsDevices[i].getCellInfo()) {
-            continue; // Skip this device if it already has cell info
+        if (bmsDevices[i].isRunning()) {
+            bmsDevices[i].monitor();
+            running++;
         }
 
-        if (!bmsDevices[i].isRunning()) {
-            if (bmsIndex < i + 1) {
-                bmsIndex = i + 1;
+        // A link that streamed anything counts as a success, however it ended
+        if (bmsLinked[i] && !bmsDevices[i].isRunning()) {
+            bmsLinked[i] = false;
+            lastLinkEnd[i] = millis();
+
+            if (bmsStreamed[i]) {
+                bmsHealth.recordSuccess(i);
             } else {
-                continue; // Skip this device if it failed to connect
+                bmsHealth.recordFailure(i, bmsDevices[i].getSession().getFailure());
+                bmsHealth.print(i);
             }
-
-            Serial.printf("Connecting to BMS device %d...\n", i + 1);
-            delaySafe(5000); // Delay to allow previous disconnect to settle
-            bmsDevices[i].connect();
         }
 
-        bmsDevices[i].monitor();
+        // Every streamed cell frame is a sample
+        if (bmsDevices[i].hasCellInfo()) {
+#ifdef JKBMS_DEBUG
+            Serial.printf("BMS device %d cell info:\n", i + 1);
+            bmsDevices[i].getCellInfo()->print();
+#endif
+
+            submitSample(i);
 
-        // Only one device can be connected at a time
-        break;
+            bmsDevices[i].resetCellInfo();
+            bmsStreamed[i] = true;
+        }
     }
 
-    // If all devices have cell info, reset them all
-    if (bmsDevices[NUM_BMS_DEVICES - 1].getCellInfo() || bmsIndex >= NUM_BMS_DEVICES && !bmsDevices[NUM_BMS_DEVICES - 1].isRunning()) {
-        for (int i = 0; i < NUM_BMS_DEVICES; i++) {
-            if (!bmsDevices[i].getCellInfo()) {
-                continue;
+    // With more devices than links, a device that has streamed for PERSISTENT_SLICE_TIME hands its link to one that is waiting
+    if (NUM_BMS_DEVICES > MAX_CONCURRENT_BMS && running >= MAX_CONCURRENT_BMS && !JKBMS::isEstablishing()) {
+        bool waiting = false;
+        for (int i = 0; i < NUM_BMS_DEVICES && !waiting; i++) {
+            waiting = isWaitingForLink(i);
+        }
+
+        int longest = -1;
+        for (int i = 0; i < NUM_BMS_DEVICES && waiting; i++) {
+            if (bmsDevices[i].isRunning() && millis() - linkStart[i] >= PERSISTENT_SLICE_TIME && (longest < 0 || (long) (linkStart[i] - linkStart[longest]) < 0)) {
+                longest = i;
             }
+        }
 
-            Serial.printf("BMS device %d cell info:\n", i + 1);
-            bmsDevices[i].getCellInfo()->print();
+        if (longest >= 0) {
+            Serial.printf("Handing the link of BMS device %d to the next device\n", longest + 1);
+            bmsDevices[longest].disconnect();
+            // Accounted for on the next pass, like any other link that ended
+            return;
+        }
+    }
 
-#ifdef USE_WIFI
-            chartClient.sendData(bmsDevices[i].getNotificationBuffer());
-#endif
+    // Bring devices up one at a time, the one off the air longest first, backing off from ones that stay away
+    while (running < MAX_CONCURRENT_BMS && !JKBMS::isEstablishing()) {
+        int next = -1;
+        for (int i = 0; i < NUM_BMS_DEVICES; i++) {
+            if (isWaitingForLink(i) && (next < 0 || (long) (lastLinkEnd[i] - lastLinkEnd[next]) < 0)) {
+                next = i;
+            }
+        }
 
-            bmsDevices[i].resetParsedData();
+        if (next < 0) {
+            break;
         }
-        
-        bmsIndex = 0;
 
-        Serial.println("All devices processed, resetting...");
-        delaySafe(5000);
+        Serial.printf("Connecting to BMS device %d...\n", next + 1);
+        bmsLinked[next] = true;
+        bmsStreamed[next] = false;
+        linkStart[next] = millis();
+        bmsDevices[next].connect();
+        running++;
     }
 }
+#else
+#ifdef ESP32
+static_assert(MAX_CONCURRENT_BMS >= 1 && MAX_CONCURRENT_BMS <= NIMBLE_MAX_CONNECTIONS, "MAX_CONCURRENT_BMS must fit in NIMBLE_MAX_CONNECTIONS");
 #endif
 
-#ifdef ARDUINO_ARCH_RP2040
+#include "PollPlanner.h"
+PollPlanner pollPlanner(scheduler, bmsHealth);
+bool bmsPolling[NUM_BMS_DEVICES] = {}; // Session started and not accounted for yet
 
 void checkJKBMS() {
-    Config& config = Config::getInstance();
-    uint8_t lastBMSChecked = config.lastBMSChecked % NUM_BMS_DEVICES;
+    size_t running = 0;
 
-    // Only probe one BMS device at a time then reset the module - workaround for RP2040 BTStack stability issues
-    if (!bmsDevices[lastBMSChecked].isRunning()) {
-        Serial.printf("Connecting to BMS device %d...\n", lastBMSChecked + 1);
-        bmsDevices[lastBMSChecked].connect();
-    }
+    for (int i = 0; i < NUM_BMS_DEVICES; i++) {
+        if (bmsDevices[i].isRunning()) {
+            bmsDevices[i].monitor();
+        }
 
-    bmsDevices[lastBMSChecked].monitor();
+        // Report what the session brought back and plan the device's next poll from it
+        if (bmsPolling[i] && !bmsDevices[i].isRunning()) {
+            bmsPolling[i] = false;
+            const CellInfo* cellInfo = nullptr;
+
+            if (bmsDevices[i].hasCellInfo()) {
+                cellInfo = bmsDevices[i].getCellInfo();
+                Serial.printf("BMS device %d cell info:\n", i + 1);
+                cellInfo->print();
+                submitSample(i);
+                bmsHealth.recordSuccess(i);
+            } else {
+                bmsHealth.recordFailure(i, bmsDevices[i].getSession().getFailure());
+                bmsHealth.print(i);
+            }
 
-    if (bmsDevices[lastBMSChecked].getCellInfo()) {
-        Serial.printf("BMS device %d cell info:\n", lastBMSChecked + 1);
-        bmsDevices[lastBMSChecked].getCellInfo()->print();
+            pollPlanner.onSessionEnded(i, cellInfo);
+            bmsDevices[i].resetParsedData();
+            lastProgressTime = millis();
+        }
 
-#ifdef USE_WIFI
-        chartClient.sendData(bmsDevices[lastBMSChecked].getNotificationBuffer());
-#endif
-        
-        config.lastBMSChecked = lastBMSChecked + 1;
-        Config::save();
+        running += bmsDevices[i].isRunning();
+    }
 
-        Serial.printf("Device %d processed, resetting...\n", lastBMSChecked + 1);
-        delaySafe(5000);
-        resetDevice();
+    // Waiting for the next poll is not a hang
+    if (!running) {
+        lastProgressTime = millis();
     }
-}
 
+    // Several devices can exchange data at once, but only one may scan or set up its connection at a time
+    while (running < MAX_CONCURRENT_BMS && !JKBMS::isEstablishing()) {
+        int i = pollPlanner.pickDue(NUM_BMS_DEVICES);
+        if (i < 0) {
+            break;
+        }
+
+        Serial.printf("Connecting to BMS device %d...\n", i + 1);
+        bmsPolling[i] = true;
+        pollPlanner.onSessionStarted(i);
+        bmsDevices[i].connect();
+        running++;
+    }
+}
 #endif
 
 #ifdef USE_LEDS
@@ -310,4 +512,4 @@ void turnOffLEDs() {
     digitalWrite(LED_RED, HIGH);
     digitalWrite(LED_GREEN, HIGH);
 }
-#endif
+#endif
\ No newline at end of file
@@ -1,64 +1,60 @@
 #ifndef BATTERY_INFO_H
 #define BATTERY_INFO_H
 
-#include "decode.h"
+#include "constants.h"
+#include "fields.h"
+
+// Battery info payload - see fields.h
+#define BATTERY_INFO_FIELDS(SCALAR, ARRAY, TEXT) \
+    TEXT(device_model, getDeviceModel, 6, 16) \
+    TEXT(hardware_version, getHardwareVersion, 22, 8) \
+    TEXT(software_version, getSoftwareVersion, 30, 8) \
+    SCALAR(uptime, getUptime, 38, uint32_t, 0, FIELD_NO_MIN, FIELD_NO_MAX) \
+    SCALAR(powerCycles, getPowerCycles, 42, uint32_t, 0, FIELD_NO_MIN, FIELD_NO_MAX) \
+    TEXT(deviceName, getDeviceName, 46, 16) \
+    TEXT(devicePasscode, getDevicePasscode, 62, 16) \
+    TEXT(firstStartupDate, getFirstStartupDate, 78, 8) \
+    TEXT(serialNumber, getSerialNumber, 86, 11) \
+    TEXT(passcode, getPasscode, 97, 5) \
+    TEXT(userData, getUserData, 102, 16) \
+    TEXT(setupPasscode, getSetupPasscode, 118, 16)
 
 struct BatteryInfo {
-    char header[12];
-    char record_type[3];
+    uint8_t record_type;
     uint8_t record_counter;
-    char device_model[16];
-    char hardware_version[8];
-    char software_version[8];
-    uint32_t uptime;
-    uint32_t powerCycles;
-    char deviceName[16];
-    char devicePasscode[16];
-    char firstStartupDate[8];
-    char serialNumber[12];
-    char passcode[5];
-    char userData[16];
-    char setupPasscode[16];
+    BATTERY_INFO_FIELDS(FIELD_MEMBER_SCALAR, FIELD_MEMBER_ARRAY, FIELD_MEMBER_TEXT)
 
     static void parseBatteryInfo(const unsigned char* data, BatteryInfo& info) {
-        parse_bytes_str(data, 0, 4, info.header);
-        parse_bytes_str(data, 4, 1, info.record_type);
+        info.record_type = parse_byte(data, 4);
         info.record_counter = parse_byte(data, 5);
-        parse_cstr(data, 6, 16, info.device_model);
-        parse_cstr(data, 22, 8, info.hardware_version);
-        parse_cstr(data, 30, 8, info.software_version);
-
-        info.uptime = parse_32bit_unsigned(data, 38);
-        info.powerCycles = parse_32bit_unsigned(data, 42);
-        parse_cstr(data, 46, 16, info.deviceName);
-        parse_cstr(data, 62, 16, info.devicePasscode);
-        parse_cstr(data, 78, 8, info.firstStartupDate);
-        parse_cstr(data, 86, 11, info.serialNumber);
-        parse_cstr(data, 97, 5, info.passcode);
-        parse_cstr(data, 102, 16, info.userData);
-        parse_cstr(data, 118, 16, info.setupPasscode);
+        BATTERY_INFO_FIELDS(FIELD_PARSE_SCALAR, FIELD_PARSE_ARRAY, FIELD_PARSE_TEXT)
     }
 
     void print() const {
-        Serial.printf(
-            "BatteryInfo(header=%s, record_type=%s, record_counter=%d, device_model=%s, hardware_version=%s, software_version=%s, "
-            "uptime=%u, powerCycles=%u, deviceName=%s, devicePasscode=%s, firstStartupDate=%s, serialNumber=%s, passcode=%s, userData=%s, setupPasscode=%s)\n",
-            header,
-            record_type,
-            record_counter,
-            device_model,
-            hardware_version,
-            software_version,
-            uptime,
-            powerCycles,
-            deviceName,
-            devicePasscode,
-            firstStartupDate,
-            serialNumber,
-            passcode,
-            userData,
-            setupPasscode);
+        Serial.printf("BatteryInfo(record_type=%02X, record_counter=%d", record_type, record_counter);
+        BATTERY_INFO_FIELDS(FIELD_PRINT_SCALAR, FIELD_PRINT_ARRAY, FIELD_PRINT_TEXT)
+        Serial.println(")");
     }
 };
 
+// Zero-copy view of a validated battery info frame - strings are copied out only when asked for,
+// into outputs with room for the field plus a null terminator
+struct BatteryFrame {
+    const unsigned char* data;
+
+    bool isValid() const { return data != nullptr; }
+    uint8_t getRecordCounter() const { return parse_byte(data, 5); }
+    BATTERY_INFO_FIELDS(FIELD_GETTER_SCALAR, FIELD_GETTER_ARRAY, FIELD_GETTER_TEXT)
+};
+
+// A device's last battery info record, reused instead of asking for it every session.
+// Plain data so it can be stored in Config as-is.
+struct StoredBatteryInfo {
+    uint8_t address[6]; // In the byte order of the BLE stack
+    uint8_t valid;
+    uint8_t reserved;
+    uint16_t sessionsSinceRefresh;
+    unsigned char record[RECORD_LENGTH];
+};
+
 #endif // BATTERY_INFO_H
\ No newline at end of file
@@ -2,98 +2,69 @@
 #define CELL_INFO_H
 
 #include "constants.h"
-#include "decode.h"
+#include "fields.h"
 
+// Cell info payload - see fields.h. Ranges are the server's columns, in stored units.
+// Alarm bits are decoded against BATTERY_ERRORS by the reader - not done here to save memory.
+#define CELL_INFO_FIELDS(SCALAR, ARRAY, TEXT) \
+    ARRAY(cell_voltages, getCellVoltage, 6, uint16_t, 16, 3, FIELD_NO_MIN, FIELD_NO_MAX) /* V */ \
+    SCALAR(average_cell_voltage, getAverageCellVoltage, 74, uint16_t, 3, 0, 5000) /* V, decimal(5, 3) */ \
+    SCALAR(delta_cell_voltage, getDeltaCellVoltage, 76, uint16_t, 3, 0, 5000) /* V, decimal(5, 3) */ \
+    ARRAY(cell_wire_resistances, getCellWireResistance, 80, uint16_t, 16, 3, FIELD_NO_MIN, FIELD_NO_MAX) /* Ohm */ \
+    SCALAR(mosfet_temperature, getMosfetTemperature, 144, int16_t, 1, -400, 999) /* C, decimal(5, 3) */ \
+    SCALAR(battery_voltage, getBatteryVoltage, 150, uint32_t, 3, 0, 99999) /* V, decimal(5, 3) */ \
+    SCALAR(battery_power, getBatteryPower, 154, uint16_t, 3, 0, 99999) /* decimal(5, 3) */ \
+    SCALAR(battery_current, getBatteryCurrent, 158, int32_t, 3, -99999, 99999) /* A, decimal(5, 3) - can be negative */ \
+    SCALAR(battery_temperature_1, getBatteryTemperature1, 162, int16_t, 1, -99999, 99999) /* C, decimal(5, 1) */ \
+    SCALAR(battery_temperature_2, getBatteryTemperature2, 164, int16_t, 1, -99999, 99999) /* C, decimal(5, 1) */ \
+    SCALAR(alarm_bits, getAlarmBits, 166, uint16_t, 0, 0, 0xFFFFFFFF) /* bigint (unsigned 32-bit) */ \
+    SCALAR(percent_remaining, getPercentRemaining, 173, uint8_t, 0, 0, 100) /* tinyint (0-100) */ \
+    SCALAR(remaining_capacity, getRemainingCapacity, 174, uint32_t, 3, 0, 9999999999LL) /* Ah, decimal(10, 3) */ \
+    SCALAR(nominal_capacity, getNominalCapacity, 178, uint32_t, 3, 0, 9999999999LL) /* Ah, decimal(10, 3) */ \
+    SCALAR(cycle_count, getCycleCount, 182, uint32_t, 0, 0, 0xFFFFFFFF) /* bigint (unsigned 32-bit) */ \
+    SCALAR(cycle_capacity, getCycleCapacity, 186, uint32_t, 3, 0, 9999999999LL) /* Ah, decimal(10, 3) */ \
+    SCALAR(state_of_health, getStateOfHealth, 190, uint8_t, 0, 0, 100) /* tinyint (0-100) */
+
+// Values are kept as the integers the BMS sends - use the float getters only where a float is needed
 struct CellInfo {
-    char header[12];
-    char record_type[3];
+    CELL_INFO_FIELDS(FIELD_MEMBER_WIDE_SCALAR, FIELD_MEMBER_WIDE_ARRAY, FIELD_IGNORE_TEXT)
+    CELL_INFO_FIELDS(FIELD_MEMBER_MEDIUM_SCALAR, FIELD_MEMBER_MEDIUM_ARRAY, FIELD_IGNORE_TEXT)
+    CELL_INFO_FIELDS(FIELD_MEMBER_NARROW_SCALAR, FIELD_MEMBER_NARROW_ARRAY, FIELD_MEMBER_TEXT)
+    uint8_t record_type;
     uint8_t record_counter;
-    float cell_voltages[16];
-    float average_cell_voltage;
-    float delta_cell_voltage;
-    float cell_wire_resistances[16];
-    float mosfet_temperature;
-    float battery_voltage;
-    float battery_power;
-    float battery_current;
-    float battery_temperature_1;
-    float battery_temperature_2;
-    uint16_t alarm_bits;
-    uint8_t percent_remaining;
-    float remaining_capacity;
-    float nominal_capacity;
-    float cycle_capacity;
-    uint8_t state_of_health;
-    uint32_t cycle_count;
+    bool in_range; // All values fit the server's columns - checked once when parsed
 
     static void parseCellInfo(const unsigned char* data, CellInfo& info) {
-        parse_bytes_str(data, 0, 4, info.header);
-        parse_bytes_str(data, 4, 1, info.record_type);
+        info.record_type = parse_byte(data, 4);
         info.record_counter = parse_byte(data, 5);
+        CELL_INFO_FIELDS(FIELD_PARSE_SCALAR, FIELD_PARSE_ARRAY, FIELD_PARSE_TEXT)
+        info.in_range = true CELL_INFO_FIELDS(FIELD_RANGE_SCALAR, FIELD_RANGE_ARRAY, FIELD_IGNORE_TEXT);
+    }
 
-        for (int i = 0; i < 16; i++) {
-            info.cell_voltages[i] = parse_16bit_unsigned(data, 6 + i * 2) / 1000.0f;
-        }
-
-        info.average_cell_voltage = parse_16bit_unsigned(data, 74) / 1000.0f;
-        info.delta_cell_voltage = parse_16bit_unsigned(data, 76) / 1000.0f;
-
-        for (int i = 0; i < 16; i++) {
-            info.cell_wire_resistances[i] = parse_16bit_unsigned(data, 80 + i * 2) / 1000.0f;
-        }
-
-        info.mosfet_temperature = parse_16bit_unsigned(data, 144) / 10.0f;
-
-        info.battery_voltage = parse_32bit_unsigned(data, 150) / 1000.0f;
-        info.battery_power = parse_16bit_unsigned(data, 154) / 1000.0f;
-        info.battery_current = parse_32bit_signed(data, 158) / 1000.0f;
-
-        info.battery_temperature_1 = parse_16bit_unsigned(data, 162) / 10.0f;
-        info.battery_temperature_2 = parse_16bit_unsigned(data, 164) / 10.0f;
-
-        info.alarm_bits = parse_16bit_unsigned(data, 166);
-        // Decoding the alarms - look at BATTERY_ERRORS - not done here to save memory
+    CELL_INFO_FIELDS(FIELD_FLOAT_SCALAR, FIELD_FLOAT_ARRAY, FIELD_IGNORE_TEXT)
 
-        info.percent_remaining = parse_byte(data, 173);
-        
-        info.remaining_capacity = parse_32bit_unsigned(data, 174) / 1000.0f;
-        info.nominal_capacity = parse_32bit_unsigned(data, 178) / 1000.0f;
-        info.cycle_count = parse_32bit_unsigned(data, 182);
-        info.cycle_capacity = parse_32bit_unsigned(data, 186) / 1000.0f;
-        info.state_of_health = parse_byte(data, 190);
+    void print() const {
+        Serial.printf("CellInfo(record_type=%02X, record_counter=%d", record_type, record_counter);
+        CELL_INFO_FIELDS(FIELD_PRINT_SCALAR, FIELD_PRINT_ARRAY, FIELD_PRINT_TEXT)
+        Serial.printf(", in_range=%d)\n", in_range);
     }
 
-    void print() const {
-        Serial.printf(
-            "CellInfo(header=%s, record_type=%s, record_counter=%d, cell_voltages=[",
-            header,
-            record_type,
-            record_counter);
-        for (int i = 0; i < 16; i++) {
-            Serial.printf("%f", cell_voltages[i]);
-            if (i < 15) Serial.printf(", ");
-        }
-        Serial.printf("], average_cell_voltage=%f, delta_cell_voltage=%f, cell_wire_resistances=[",
-            average_cell_voltage,
-            delta_cell_voltage);
-        for (int i = 0; i < 16; i++) {
-            Serial.printf("%f", cell_wire_resistances[i]);
-            if (i < 15) Serial.printf(", ");
-        }
-        Serial.printf("], mosfet_temperature=%f, battery_voltage=%f, battery_power=%f, battery_current=%f, battery_temperature_1=%f, battery_temperature_2=%f, percent_remaining=%d, remaining_capacity=%f, nominal_capacity=%f, cycle_capacity=%f, state_of_health=%d, cycle_count=%d)\n",
-            mosfet_temperature,
-            battery_voltage,
-            battery_power,
-            battery_current,
-            battery_temperature_1,
-            battery_temperature_2,
-            percent_remaining,
-            remaining_capacity,
-            nominal_capacity,
-            cycle_capacity,
-            state_of_health,
-            cycle_count);
+    // Write the fields as a JSON object
+    void printJson(Print& out) const {
+        const char* separator = "";
+        out.print("{");
+        CELL_INFO_FIELDS(FIELD_JSON_SCALAR, FIELD_JSON_ARRAY, FIELD_JSON_TEXT)
+        out.print("}");
     }
 };
 
+// Zero-copy view of a validated cell info frame - each getter decodes its field on demand, in the same units as CellInfo
+struct CellFrame {
+    const unsigned char* data;
+
+    bool isValid() const { return data != nullptr; }
+    uint8_t getRecordCounter() const { return parse_byte(data, 5); }
+    CELL_INFO_FIELDS(FIELD_GETTER_SCALAR, FIELD_GETTER_ARRAY, FIELD_GETTER_TEXT)
+};
+
 #endif // CELL_INFO_H
\ No newline at end of file
@@ -9,10 +9,22 @@
 #define CONNECT_TIME 10000
 #define EXCHANGE_TIME 1000
 #define ACTIVITY_TIMEOUT 10000
+#define REQUEST_TIMEOUT 2000 // Ask again if a request got no answer in this time
+#define MAX_REQUEST_RETRIES 2
+#define SCAN_CACHE_TIME 60000 // Connect straight to devices seen this recently, without scanning
+#define MAX_SCAN_DEVICES 8
+#define RECONNECT_DELAY 5000 // Persistent mode only, between reconnect attempts after a lost link
+#define PERSISTENT_SLICE_TIME 60000 // Persistent mode with more devices than links, time a link streams before it is handed on
+#define SUBSCRIBE_SETTLE_TIME 100 // Between enabling notifications and the first request
+#define MAX_SCHEDULED_TIMERS 16
 
 #define INTERRUPT_MAX_DESYNC 2000
 
 #define NOTIFICATION_BUFFER_SIZE 512
+#define RECORD_LENGTH 300 // Some firmware pads records to 320 bytes, the padding is skipped while searching
+#define RECORD_TYPE_INDEX 4
+#define MAX_RECORD_LISTENERS 4
+#define NOTIFICATION_RING_SIZE 2048 // Bytes queued between the BLE callback and monitor(), must be a power of two
 
 #define SETTINGS_INFO_RECORD_TYPE 1
 #define CELL_INFO_RECORD_TYPE 2
@@ -1,10 +1,11 @@
 #include "decode.h"
 
 void parse_cstr(const unsigned char* data, size_t index, size_t length, char* output) {
-    for (size_t i = 0; i < length && data[index + i] != '\0'; i++) {
+    size_t i = 0;
+    for (; i < length && data[index + i] != '\0'; i++) {
         output[i] = data[index + i];
     }
-    output[length] = '\0'; // Null-terminate the output string, in case it's not already
+    output[i] = '\0'; // Null-terminate the output string, in case it's not already
 }
 
 // NOTE: the output string should be 3 * length
@@ -24,6 +25,10 @@ uint16_t parse_16bit_unsigned(const unsigned char* data, size_t index) {
     return (static_cast<uint8_t>(data[index + 1]) << 8) | (static_cast<uint8_t>(data[index]) << 0);
 }
 
+int16_t parse_16bit_signed(const unsigned char* data, size_t index) {
+    return static_cast<int16_t>(parse_16bit_unsigned(data, index));
+}
+
 uint32_t parse_32bit_unsigned(const unsigned char* data, size_t index) {
     return (static_cast<uint8_t>(data[index + 3]) << 24) |
            (static_cast<uint8_t>(data[index + 2]) << 16) |
@@ -43,4 +48,26 @@ uint8_t crc8(const uint8_t* byteData, size_t length) {
         crc &= 0xff; // Ensure crc is within 0-255
     }
     return crc;
+}
+
+void print_fixed(Print& out, uint32_t magnitude, bool negative, uint8_t decimals) {
+    char text[16]; // Sign, 10 digits, decimal point
+    char* end = text + sizeof(text);
+    char* start = end;
+    uint8_t digits = 0;
+
+    // Least significant digit first, padding with zeros until there is one before the decimal point
+    do {
+        *--start = '0' + magnitude % 10;
+        magnitude /= 10;
+        if (++digits == decimals) {
+            *--start = '.';
+        }
+    } while (magnitude || digits <= decimals);
+
+    if (negative) {
+        *--start = '-';
+    }
+
+    out.write((const uint8_t*) start, end - start);
 }
\ No newline at end of file
@@ -13,10 +13,23 @@ uint8_t parse_byte(const unsigned char* data, size_t index);
 
 uint16_t parse_16bit_unsigned(const unsigned char* data, size_t index);
 
+int16_t parse_16bit_signed(const unsigned char* data, size_t index);
+
 uint32_t parse_32bit_unsigned(const unsigned char* data, size_t index);
 
 int32_t parse_32bit_signed(const unsigned char* data, size_t index);
 
 uint8_t crc8(const uint8_t* byteData, size_t length);
 
+// Write value / 10^decimals without going through printf
+void print_fixed(Print& out, uint32_t magnitude, bool negative, uint8_t decimals);
+
+// Typed decoding, used by the field tables
+template <typename T> T parse_field(const unsigned char* data, size_t index);
+template <> inline uint8_t parse_field<uint8_t>(const unsigned char* data, size_t index) { return parse_byte(data, index); }
+template <> inline uint16_t parse_field<uint16_t>(const unsigned char* data, size_t index) { return parse_16bit_unsigned(data, index); }
+template <> inline int16_t parse_field<int16_t>(const unsigned char* data, size_t index) { return parse_16bit_signed(data, index); }
+template <> inline uint32_t parse_field<uint32_t>(const unsigned char* data, size_t index) { return parse_32bit_unsigned(data, index); }
+template <> inline int32_t parse_field<int32_t>(const unsigned char* data, size_t index) { return parse_32bit_signed(data, index); }
+
 #endif // DECODE_H
\ No newline at end of file
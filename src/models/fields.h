@@ -0,0 +1,121 @@
+#ifndef MODELS_FIELDS_H
+#define MODELS_FIELDS_H
+
+#include "decode.h"
+
+// Each record type describes its payload once, as a table of the form TABLE(SCALAR, ARRAY, TEXT), with
+//   SCALAR(name, getter, offset, type, decimals, min, max)
+//   ARRAY(name, getter, offset, type, count, decimals, min, max)
+//   TEXT(name, getter, offset, length)
+// Values are stored as sent, so a field with 3 decimals holds thousandths. min/max bound the stored value.
+// The macros below expand a table into members, parsing, frame getters, range checks, printing and JSON,
+// so offsets and scales only ever live in one place.
+
+#define FIELD_NO_MIN INT64_MIN
+#define FIELD_NO_MAX INT64_MAX
+
+#define FIELD_IGNORE_TEXT(name, getter, offset, length)
+
+// Members
+#define FIELD_MEMBER_SCALAR(name, getter, offset, type, decimals, min, max) type name;
+#define FIELD_MEMBER_ARRAY(name, getter, offset, type, count, decimals, min, max) type name[count];
+#define FIELD_MEMBER_TEXT(name, getter, offset, length) char name[length + 1];
+
+// Members of one size class at a time - expanding a table once per class, widest first, leaves no padding between them
+#define FIELD_MEMBER_WIDE_SCALAR(name, getter, offset, type, decimals, min, max) FIELD_SIZE_CLASS_##type(type name;, , )
+#define FIELD_MEMBER_WIDE_ARRAY(name, getter, offset, type, count, decimals, min, max) FIELD_SIZE_CLASS_##type(type name[count];, , )
+#define FIELD_MEMBER_MEDIUM_SCALAR(name, getter, offset, type, decimals, min, max) FIELD_SIZE_CLASS_##type(, type name;, )
+#define FIELD_MEMBER_MEDIUM_ARRAY(name, getter, offset, type, count, decimals, min, max) FIELD_SIZE_CLASS_##type(, type name[count];, )
+#define FIELD_MEMBER_NARROW_SCALAR(name, getter, offset, type, decimals, min, max) FIELD_SIZE_CLASS_##type(, , type name;)
+#define FIELD_MEMBER_NARROW_ARRAY(name, getter, offset, type, count, decimals, min, max) FIELD_SIZE_CLASS_##type(, , type name[count];)
+
+#define FIELD_SIZE_CLASS_int32_t(wide, medium, narrow) wide
+#define FIELD_SIZE_CLASS_uint32_t(wide, medium, narrow) wide
+#define FIELD_SIZE_CLASS_int16_t(wide, medium, narrow) medium
+#define FIELD_SIZE_CLASS_uint16_t(wide, medium, narrow) medium
+#define FIELD_SIZE_CLASS_int8_t(wide, medium, narrow) narrow
+#define FIELD_SIZE_CLASS_uint8_t(wide, medium, narrow) narrow
+
+// Decoding every field into a struct called info
+#define FIELD_PARSE_SCALAR(name, getter, offset, type, decimals, min, max) \
+    info.name = parse_field<type>(data, offset);
+#define FIELD_PARSE_ARRAY(name, getter, offset, type, count, decimals, min, max) \
+    for (size_t i = 0; i < count; i++) { info.name[i] = parse_field<type>(data, offset + i * sizeof(type)); }
+#define FIELD_PARSE_TEXT(name, getter, offset, length) \
+    parse_cstr(data, offset, length, info.name);
+
+// Getters decoding a single field straight from a frame
+#define FIELD_GETTER_SCALAR(name, getter, offset, type, decimals, min, max) \
+    type getter() const { return parse_field<type>(data, offset); }
+#define FIELD_GETTER_ARRAY(name, getter, offset, type, count, decimals, min, max) \
+    type getter(size_t index) const { return parse_field<type>(data, offset + index * sizeof(type)); }
+#define FIELD_GETTER_TEXT(name, getter, offset, length) \
+    void getter(char* output) const { parse_cstr(data, offset, length, output); }
+
+// Float getters on a decoded struct, in display units - only for fixed-point fields, counts and bit fields stay integers
+#define FIELD_FLOAT_SCALAR(name, getter, offset, type, decimals, min, max) \
+    FIELD_IF_DECIMALS_##decimals(float getter() const { return name / field_scale(decimals); })
+#define FIELD_FLOAT_ARRAY(name, getter, offset, type, count, decimals, min, max) \
+    FIELD_IF_DECIMALS_##decimals(float getter(size_t index) const { return name[index] / field_scale(decimals); })
+
+#define FIELD_IF_DECIMALS_0(definition)
+#define FIELD_IF_DECIMALS_1(definition) definition
+#define FIELD_IF_DECIMALS_2(definition) definition
+#define FIELD_IF_DECIMALS_3(definition) definition
+
+// Range checks on a decoded struct called info, chained with & so there is no early exit
+#define FIELD_RANGE_SCALAR(name, getter, offset, type, decimals, min, max) \
+    & field_in_range(info.name, min, max)
+#define FIELD_RANGE_ARRAY(name, getter, offset, type, count, decimals, min, max) \
+    & field_array_in_range(info.name, count, min, max)
+
+// Debug printing to Serial, as ", name=value"
+#define FIELD_PRINT_SCALAR(name, getter, offset, type, decimals, min, max) \
+    Serial.print(", " #name "="); print_field(Serial, name, decimals);
+#define FIELD_PRINT_ARRAY(name, getter, offset, type, count, decimals, min, max) \
+    Serial.print(", " #name "=["); print_field_array(Serial, name, count, decimals, ", "); Serial.print("]");
+#define FIELD_PRINT_TEXT(name, getter, offset, length) \
+    Serial.print(", " #name "="); Serial.print(name);
+
+// JSON members, written to a Print called out - separator must start as ""
+#define FIELD_JSON_SCALAR(name, getter, offset, type, decimals, min, max) \
+    out.print(separator); out.print("\"" #name "\":"); print_field(out, name, decimals); separator = ",";
+#define FIELD_JSON_ARRAY(name, getter, offset, type, count, decimals, min, max) \
+    out.print(separator); out.print("\"" #name "\":["); print_field_array(out, name, count, decimals, ","); out.print("]"); separator = ",";
+#define FIELD_JSON_TEXT(name, getter, offset, length) \
+    out.print(separator); out.print("\"" #name "\":\""); out.print(name); out.print("\""); separator = ",";
+
+constexpr float field_scale(uint8_t decimals) {
+    return decimals == 0 ? 1.0f : 10.0f * field_scale(decimals - 1);
+}
+
+template <typename T>
+inline bool field_in_range(T value, int64_t min, int64_t max) {
+    return (static_cast<int64_t>(value) >= min) & (static_cast<int64_t>(value) <= max);
+}
+
+template <typename T>
+inline bool field_array_in_range(const T* values, size_t count, int64_t min, int64_t max) {
+    bool inRange = true;
+    for (size_t i = 0; i < count; i++) {
+        inRange &= field_in_range(values[i], min, max);
+    }
+    return inRange;
+}
+
+template <typename T>
+inline void print_field(Print& out, T value, uint8_t decimals) {
+    int64_t wide = static_cast<int64_t>(value);
+    bool negative = wide < 0;
+    print_fixed(out, static_cast<uint32_t>(negative ? -wide : wide), negative, decimals);
+}
+
+template <typename T>
+inline void print_field_array(Print& out, const T* values, size_t count, uint8_t decimals, const char* separator) {
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) out.print(separator);
+        print_field(out, values[i], decimals);
+    }
+}
+
+#endif // MODELS_FIELDS_H
\ No newline at end of file
@@ -0,0 +1,20 @@
+#ifndef MODELS_GATT_HANDLES_H
+#define MODELS_GATT_HANDLES_H
+
+#include <Arduino.h>
+
+// Attribute handles of a BMS's FFE0 service and FFE1 characteristic, as found by discovery.
+// Plain data so it can be stored in Config as-is.
+struct GattHandles {
+    uint8_t address[6]; // In the byte order of the BLE stack
+    uint8_t valid;
+    uint8_t properties;
+    uint16_t serviceStart;
+    uint16_t serviceEnd;
+    uint16_t characteristicStart;
+    uint16_t valueHandle;
+    uint16_t characteristicEnd;
+    uint16_t configHandle; // Client characteristic configuration descriptor, 0 if not known
+};
+
+#endif // MODELS_GATT_HANDLES_H
\ No newline at end of file
@@ -0,0 +1,15 @@
+#ifndef MODELS_SAMPLE_H
+#define MODELS_SAMPLE_H
+
+#include "cell_info.h"
+
+// One validated reading ready for upload - plain data, so it can be copied through a queue by value
+struct BMSSample {
+    uint8_t device; // Index into the configured BMS devices
+    uint8_t address[6]; // Bluetooth address of the BMS, most significant byte first
+    char serialNumber[13];
+    uint32_t capturedAt; // Unix time in seconds, 0 if the clock was not set yet
+    CellInfo cellInfo;
+};
+
+#endif // MODELS_SAMPLE_H
\ No newline at end of file
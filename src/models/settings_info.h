@@ -1,22 +1,34 @@
 #ifndef SETTINGS_INFO_H
 #define SETTINGS_INFO_H
 
-#include "decode.h"
+#include "fields.h"
+
+// Settings info payload - see fields.h. Nothing in it is used yet, so only the record counter is described.
+#define SETTINGS_INFO_FIELDS(SCALAR, ARRAY, TEXT) \
+    SCALAR(record_counter, getRecordCounter, 15, uint8_t, 0, FIELD_NO_MIN, FIELD_NO_MAX)
 
 struct SettingsInfo {
-    char header[12];
-    char record_type[3];
-    uint8_t record_counter;
+    uint8_t record_type;
+    SETTINGS_INFO_FIELDS(FIELD_MEMBER_SCALAR, FIELD_MEMBER_ARRAY, FIELD_MEMBER_TEXT)
 
     static void parseSettingsInfo(const unsigned char* data, SettingsInfo& info) {
-        parse_bytes_str(data, 0, 4, info.header);
-        parse_bytes_str(data, 4, 1, info.record_type);
-        info.record_counter = parse_byte(data, 15);
+        info.record_type = parse_byte(data, 4);
+        SETTINGS_INFO_FIELDS(FIELD_PARSE_SCALAR, FIELD_PARSE_ARRAY, FIELD_PARSE_TEXT)
     }
 
     void print() const {
-        Serial.printf("SettingsInfo(header=%s, record_type=%s, record_counter=%d)\n", header, record_type, record_counter);
+        Serial.printf("SettingsInfo(record_type=%02X", record_type);
+        SETTINGS_INFO_FIELDS(FIELD_PRINT_SCALAR, FIELD_PRINT_ARRAY, FIELD_PRINT_TEXT)
+        Serial.println(")");
     }
 };
 
+// Zero-copy view of a validated settings info frame
+struct SettingsFrame {
+    const unsigned char* data;
+
+    bool isValid() const { return data != nullptr; }
+    SETTINGS_INFO_FIELDS(FIELD_GETTER_SCALAR, FIELD_GETTER_ARRAY, FIELD_GETTER_TEXT)
+};
+
 #endif // SETTINGS_INFO_H
\ No newline at end of file
@@ -0,0 +1,122 @@
+#include "telemetry.h"
+
+// Expansions of CELL_INFO_FIELDS for the binary format, each moving a running field index along
+#define FIELD_COUNT_SCALAR(name, getter, offset, type, decimals, min, max) + 1
+#define FIELD_COUNT_ARRAY(name, getter, offset, type, count, decimals, min, max) + 1
+#define FIELD_COUNT_TEXT(name, getter, offset, length) + 1
+
+// Presence bits for a struct called info
+#define FIELD_PRESENCE_SCALAR(name, getter, offset, type, decimals, min, max) \
+    if (info.name != 0) { presence |= 1UL << field; } field++;
+#define FIELD_PRESENCE_ARRAY(name, getter, offset, type, count, decimals, min, max) \
+    if (telemetry_array_length(info.name, count) > 0) { presence |= 1UL << field; } field++;
+
+// Present fields of info, written to a TelemetryWriter called out
+#define FIELD_ENCODE_SCALAR(name, getter, offset, type, decimals, min, max) \
+    if (presence & (1UL << field)) { out.put<type>(info.name); } field++;
+#define FIELD_ENCODE_ARRAY(name, getter, offset, type, count, decimals, min, max) \
+    if (presence & (1UL << field)) { \
+        uint8_t length = telemetry_array_length(info.name, count); \
+        out.put<uint8_t>(length); \
+        for (size_t i = 0; i < length; i++) { out.put<type>(info.name[i]); } \
+    } \
+    field++;
+
+// Fields read back from a TelemetryReader called in, failing on arrays longer than the table allows
+#define FIELD_DECODE_SCALAR(name, getter, offset, type, decimals, min, max) \
+    info.name = (presence & (1UL << field)) ? in.get<type>() : 0; field++;
+#define FIELD_DECODE_ARRAY(name, getter, offset, type, count, decimals, min, max) \
+    memset(info.name, 0, sizeof(info.name)); \
+    if (presence & (1UL << field)) { \
+        uint8_t length = in.get<uint8_t>(); \
+        if (length > count) { return false; } \
+        for (size_t i = 0; i < length; i++) { info.name[i] = in.get<type>(); } \
+    } \
+    field++;
+
+#define CELL_INFO_FIELD_COUNT (0 CELL_INFO_FIELDS(FIELD_COUNT_SCALAR, FIELD_COUNT_ARRAY, FIELD_COUNT_TEXT))
+
+static_assert(CELL_INFO_FIELD_COUNT <= 32, "Cell info fields no longer fit the presence bitmap");
+
+template <typename T>
+static uint8_t telemetry_array_length(const T* values, size_t count) {
+    size_t length = count;
+    while (length > 0 && values[length - 1] == 0) {
+        length--;
+    }
+    return static_cast<uint8_t>(length);
+}
+
+void encodeTelemetrySample(TelemetryWriter& out, const BMSSample& sample) {
+    const CellInfo& info = sample.cellInfo;
+
+    uint32_t presence = 0;
+    size_t field = 0;
+    CELL_INFO_FIELDS(FIELD_PRESENCE_SCALAR, FIELD_PRESENCE_ARRAY, FIELD_IGNORE_TEXT)
+
+    out.putBytes(sample.address, TELEMETRY_DEVICE_ID_LENGTH);
+    out.put<uint32_t>(sample.capturedAt);
+    out.put<uint32_t>(presence);
+
+    field = 0;
+    CELL_INFO_FIELDS(FIELD_ENCODE_SCALAR, FIELD_ENCODE_ARRAY, FIELD_IGNORE_TEXT)
+}
+
+bool decodeTelemetrySample(TelemetryReader& in, BMSSample& sample) {
+    memset(&sample, 0, sizeof(sample));
+    CellInfo& info = sample.cellInfo;
+
+    in.getBytes(sample.address, TELEMETRY_DEVICE_ID_LENGTH);
+    sample.capturedAt = in.get<uint32_t>();
+    uint32_t presence = in.get<uint32_t>();
+
+    // Bits past the table are fields from a newer layout, which would have bumped the version
+    if (CELL_INFO_FIELD_COUNT < 32 && (presence >> CELL_INFO_FIELD_COUNT) != 0) {
+        return false;
+    }
+
+    size_t field = 0;
+    CELL_INFO_FIELDS(FIELD_DECODE_SCALAR, FIELD_DECODE_ARRAY, FIELD_IGNORE_TEXT)
+
+    info.in_range = true CELL_INFO_FIELDS(FIELD_RANGE_SCALAR, FIELD_RANGE_ARRAY, FIELD_IGNORE_TEXT);
+    return !in.truncated();
+}
+
+bool encodeTelemetry(const BMSSample* samples, size_t count, uint8_t* output, size_t capacity, size_t& length) {
+    TelemetryWriter out(output, capacity);
+
+    out.put<uint8_t>('J');
+    out.put<uint8_t>('K');
+    out.put<uint8_t>(TELEMETRY_VERSION);
+    out.put<uint8_t>(static_cast<uint8_t>(count));
+
+    for (size_t i = 0; i < count; i++) {
+        encodeTelemetrySample(out, samples[i]);
+    }
+
+    length = out.length();
+    return count <= UINT8_MAX && !out.overflowed();
+}
+
+bool decodeTelemetry(const uint8_t* data, size_t length, BMSSample* samples, size_t capacity, size_t& count) {
+    TelemetryReader in(data, length);
+    count = 0;
+
+    uint8_t magic[2];
+    in.getBytes(magic, sizeof(magic));
+    uint8_t version = in.get<uint8_t>();
+    uint8_t sampleCount = in.get<uint8_t>();
+
+    if (in.truncated() || magic[0] != 'J' || magic[1] != 'K' || version != TELEMETRY_VERSION || sampleCount > capacity) {
+        return false;
+    }
+
+    for (size_t i = 0; i < sampleCount; i++) {
+        if (!decodeTelemetrySample(in, samples[i])) {
+            return false;
+        }
+    }
+
+    count = sampleCount;
+    return in.remaining() == 0;
+}
\ No newline at end of file
@@ -0,0 +1,110 @@
+#ifndef MODELS_TELEMETRY_H
+#define MODELS_TELEMETRY_H
+
+#include "sample.h"
+
+// Compact binary alternative to the JSON upload, little-endian throughout:
+//
+//   Message  u8 'J', u8 'K', u8 version, u8 sample count, then each sample
+//   Sample   u8[6] device ID - the BMS's Bluetooth address, most significant byte first
+//            u32 capture time - Unix time in seconds, 0 if the clock was not set yet
+//            u32 presence bitmap - bit n is set if field n of CELL_INFO_FIELDS follows, a field left out is 0
+//            each present field, in table order
+//   Scalar   the stored value, in the table's integer type - fixed point with the table's decimals
+//   Array    u8 length, then that many stored values - trailing zeros, e.g. unused cells, are left out
+//
+// The field table defines the layout, so TELEMETRY_VERSION has to change whenever CELL_INFO_FIELDS does.
+// decodeTelemetry() is the reference decoder for the server side.
+
+#define TELEMETRY_VERSION 2
+#define TELEMETRY_HEADER_LENGTH 4
+#define TELEMETRY_DEVICE_ID_LENGTH 6
+
+// Longest encoding of each field, and of a sample with every field present and every array full
+#define FIELD_MAX_LENGTH_SCALAR(name, getter, offset, type, decimals, min, max) + sizeof(type)
+#define FIELD_MAX_LENGTH_ARRAY(name, getter, offset, type, count, decimals, min, max) + 1 + count * sizeof(type)
+#define TELEMETRY_SAMPLE_MAX_LENGTH (TELEMETRY_DEVICE_ID_LENGTH + 2 * sizeof(uint32_t) CELL_INFO_FIELDS(FIELD_MAX_LENGTH_SCALAR, FIELD_MAX_LENGTH_ARRAY, FIELD_IGNORE_TEXT))
+
+// Appends little-endian values to a fixed buffer, remembering if any did not fit
+class TelemetryWriter {
+public:
+    TelemetryWriter(uint8_t* buffer, size_t capacity) : buffer(buffer), capacity(capacity) {}
+
+    void putBytes(const uint8_t* data, size_t length) {
+        if (used + length > capacity) {
+            isOverflowed = true;
+            return;
+        }
+
+        memcpy(buffer + used, data, length);
+        used += length;
+    }
+
+    template <typename T>
+    void put(T value) {
+        uint8_t bytes[sizeof(T)];
+        for (size_t i = 0; i < sizeof(T); i++) {
+            bytes[i] = static_cast<uint8_t>(static_cast<uint32_t>(value) >> (8 * i));
+        }
+        putBytes(bytes, sizeof(T));
+    }
+
+    size_t length() const { return used; }
+    bool overflowed() const { return isOverflowed; }
+private:
+    uint8_t* buffer;
+    size_t capacity;
+    size_t used = 0;
+    bool isOverflowed = false;
+};
+
+// Reads little-endian values back, remembering if the input ran out - reads past the end return 0
+class TelemetryReader {
+public:
+    TelemetryReader(const uint8_t* data, size_t length) : data(data), length(length) {}
+
+    bool getBytes(uint8_t* output, size_t count) {
+        if (used + count > length) {
+            isTruncated = true;
+            memset(output, 0, count);
+            return false;
+        }
+
+        memcpy(output, data + used, count);
+        used += count;
+        return true;
+    }
+
+    template <typename T>
+    T get() {
+        uint8_t bytes[sizeof(T)];
+        getBytes(bytes, sizeof(T));
+
+        uint32_t value = 0;
+        for (size_t i = 0; i < sizeof(T); i++) {
+            value |= static_cast<uint32_t>(bytes[i]) << (8 * i);
+        }
+        return static_cast<T>(value);
+    }
+
+    size_t remaining() const { return length - used; }
+    bool truncated() const { return isTruncated; }
+private:
+    const uint8_t* data;
+    size_t length;
+    size_t used = 0;
+    bool isTruncated = false;
+};
+
+// A single sample, without the message header - e.g. for records of the sample log
+void encodeTelemetrySample(TelemetryWriter& out, const BMSSample& sample);
+bool decodeTelemetrySample(TelemetryReader& in, BMSSample& sample);
+
+// Writes a whole message - false if it does not fit, length is set either way
+bool encodeTelemetry(const BMSSample* samples, size_t count, uint8_t* output, size_t capacity, size_t& length);
+
+// Reads a whole message back - false if it is malformed, from another version or has more than capacity samples.
+// Decoded samples have no serial number and device set to 0, the device ID goes into address.
+bool decodeTelemetry(const uint8_t* data, size_t length, BMSSample* samples, size_t capacity, size_t& count);
+
+#endif // MODELS_TELEMETRY_H
\ No newline at end of file
@@ -0,0 +1,56 @@
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+// Just enough of the Arduino API for the code that does not touch the radio to build and run on the host - see [env:native]
+
+#include <chrono>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#define PROGMEM
+
+class Print {
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t value) = 0;
+    virtual size_t write(const uint8_t* data, size_t size) {
+        size_t written = 0;
+        while (size--) {
+            written += write(*data++);
+        }
+        return written;
+    }
+
+    size_t print(const char* text) { return write((const uint8_t*) text, strlen(text)); }
+    size_t println(const char* text = "") { return print(text) + print("\n"); }
+
+    int printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        char text[256];
+        va_list arguments;
+        va_start(arguments, format);
+        int length = vsnprintf(text, sizeof(text), format, arguments);
+        va_end(arguments);
+        write((const uint8_t*) text, strnlen(text, sizeof(text)));
+        return length;
+    }
+};
+
+class HardwareSerial : public Print {
+public:
+    void begin(unsigned long baud) {}
+    size_t write(uint8_t value) override { return fwrite(&value, 1, 1, stdout); }
+    size_t write(const uint8_t* data, size_t size) override { return fwrite(data, 1, size, stdout); }
+};
+
+static HardwareSerial Serial;
+
+inline unsigned long millis() {
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+#endif // NATIVE_ARDUINO_H
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include <unity.h>
+
+#include "JKBMSNotificationBuffer.h"
+
+// Feeds records through JKBMSNotificationBuffer in pieces, to check that bytes looking like stream tokens stay record data
+
+// A cell info record with the given bytes at offset, with a byte of the payload picked so the checksum comes out as crc
+static void makeRecord(unsigned char* record, const unsigned char* pattern, size_t patternLength, size_t offset, unsigned char crc) {
+    memset(record, 0, RECORD_LENGTH);
+    memcpy(record, START_OF_RECORD, sizeof(START_OF_RECORD));
+    record[RECORD_TYPE_INDEX] = CELL_INFO_RECORD_TYPE;
+    if (patternLength > 0) {
+        memcpy(record + offset, pattern, patternLength);
+    }
+
+    for (int value = 0; value < 256; value++) {
+        record[RECORD_LENGTH - 2] = value;
+        if (crc8(record, RECORD_LENGTH - 1) == crc) {
+            break;
+        }
+    }
+
+    record[RECORD_LENGTH - 1] = crc8(record, RECORD_LENGTH - 1);
+}
+
+// True once the notification holding the last byte of the record has been handled, and not before
+static bool feed(JKBMSNotificationBuffer& buffer, const unsigned char* data, size_t length, size_t chunk) {
+    bool processed = false;
+    for (size_t offset = 0; offset < length; offset += chunk) {
+        size_t count = length - offset < chunk ? length - offset : chunk;
+        bool last = offset + count == length;
+        bool result = buffer.handleNotification(data + offset, count);
+        if (result && !last) {
+            return false;
+        }
+        processed = result;
+    }
+    return processed;
+}
+
+static const size_t CHUNKS[] = { 1, 7, 20, RECORD_LENGTH };
+
+static void checkRecord(const unsigned char* record) {
+    for (size_t chunk : CHUNKS) {
+        JKBMSNotificationBuffer buffer;
+        TEST_ASSERT_TRUE(feed(buffer, record, RECORD_LENGTH, chunk));
+        TEST_ASSERT_TRUE(buffer.hasCellInfo());
+        TEST_ASSERT_EQUAL(1, buffer.getFrameStats().recordsParsed);
+        TEST_ASSERT_EQUAL(0, buffer.getFrameStats().crcErrors);
+        TEST_ASSERT_EQUAL(0, buffer.getFrameStats().keepAlives);
+        TEST_ASSERT_EQUAL(0, buffer.getFrameStats().pingResponses);
+        TEST_ASSERT_EQUAL(0, buffer.getFrameStats().truncatedRecords);
+    }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_record_ending_in_token_start_is_processed_at_once() {
+    const unsigned char endings[] = { KEEP_ALIVE[0], PING_RESPONSE[0], START_OF_RECORD[0] };
+    for (unsigned char crc : endings) {
+        unsigned char record[RECORD_LENGTH];
+        makeRecord(record, nullptr, 0, 0, crc);
+        TEST_ASSERT_EQUAL(crc, record[RECORD_LENGTH - 1]);
+        checkRecord(record);
+    }
+}
+
+void test_embedded_keep_alive_stays_in_record() {
+    unsigned char record[RECORD_LENGTH];
+    makeRecord(record, KEEP_ALIVE, sizeof(KEEP_ALIVE) - 1, 50, 0x7b);
+    checkRecord(record);
+}
+
+void test_embedded_ping_response_stays_in_record() {
+    unsigned char record[RECORD_LENGTH];
+    makeRecord(record, PING_RESPONSE, sizeof(PING_RESPONSE), 50, 0x7b);
+    checkRecord(record);
+}
+
+void test_embedded_start_of_record_stays_in_record() {
+    unsigned char record[RECORD_LENGTH];
+    makeRecord(record, START_OF_RECORD, sizeof(START_OF_RECORD), 50, 0x7b);
+    checkRecord(record);
+}
+
+void test_tokens_between_records_are_counted() {
+    unsigned char record[RECORD_LENGTH];
+    makeRecord(record, KEEP_ALIVE, sizeof(KEEP_ALIVE) - 1, 50, START_OF_RECORD[0]);
+
+    unsigned char stream[sizeof(KEEP_ALIVE) - 1 + RECORD_LENGTH + sizeof(PING_RESPONSE) + RECORD_LENGTH];
+    size_t length = 0;
+    memcpy(stream + length, KEEP_ALIVE, sizeof(KEEP_ALIVE) - 1);
+    length += sizeof(KEEP_ALIVE) - 1;
+    memcpy(stream + length, record, RECORD_LENGTH);
+    length += RECORD_LENGTH;
+    memcpy(stream + length, PING_RESPONSE, sizeof(PING_RESPONSE));
+    length += sizeof(PING_RESPONSE);
+    memcpy(stream + length, record, RECORD_LENGTH);
+    length += RECORD_LENGTH;
+
+    for (size_t chunk : CHUNKS) {
+        JKBMSNotificationBuffer buffer;
+        for (size_t offset = 0; offset < length; offset += chunk) {
+            buffer.handleNotification(stream + offset, length - offset < chunk ? length - offset : chunk);
+        }
+
+        TEST_ASSERT_EQUAL(2, buffer.getFrameStats().recordsParsed);
+        TEST_ASSERT_EQUAL(1, buffer.getFrameStats().keepAlives);
+        TEST_ASSERT_EQUAL(1, buffer.getFrameStats().pingResponses);
+        TEST_ASSERT_EQUAL(0, buffer.getFrameStats().crcErrors);
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_record_ending_in_token_start_is_processed_at_once);
+    RUN_TEST(test_embedded_keep_alive_stays_in_record);
+    RUN_TEST(test_embedded_ping_response_stays_in_record);
+    RUN_TEST(test_embedded_start_of_record_stays_in_record);
+    RUN_TEST(test_tokens_between_records_are_counted);
+    return UNITY_END();
+}
\ No newline at end of file
@@ -0,0 +1,195 @@
+#include <unity.h>
+
+#include "JKBMSSession.h"
+
+// Runs JKBMSSession against a fake clock and a fake BMS, so request pacing, retries and latency can be checked off-target
+
+static unsigned long now = 0;
+static unsigned long fakeClock() {
+    return now;
+}
+
+// Discards the session's log, the test output stays readable
+class NullPrint : public Print {
+public:
+    size_t write(uint8_t value) override { return 1; }
+};
+
+// Answers each request with the records a JK BMS would send, after a fixed delay
+class FakeTransport : public JKBMSTransport {
+public:
+    unsigned long responseDelay = 30;
+    bool respond = true;
+    bool corruptRecords = false;
+    int failSends = 0; // The next this many sends fail
+
+    int requests = 0;
+    unsigned char lastCommand = 0;
+    int ended = -1;
+
+    bool sendCommand(const unsigned char* command, size_t length) override {
+        if (failSends > 0) {
+            failSends--;
+            return false;
+        }
+
+        requests++;
+        lastCommand = command[4];
+        if (respond) {
+            pendingCommand = lastCommand;
+            respondAt = now + responseDelay;
+        }
+        return true;
+    }
+
+    void endSession(JKBMSSessionState result) override {
+        ended = result;
+    }
+
+    // Delivers whatever is due, the settings request is answered with settings and then cell info
+    void deliver(JKBMSSession& session) {
+        if (!pendingCommand || (long) (now - respondAt) < 0) {
+            return;
+        }
+
+        unsigned char command = pendingCommand;
+        pendingCommand = 0;
+
+        if (command == GET_BATTERY_INFO[4]) {
+            sendRecord(session, 0x03);
+        } else {
+            sendRecord(session, 0x01);
+            sendRecord(session, 0x02);
+        }
+    }
+private:
+    unsigned char pendingCommand = 0;
+    unsigned long respondAt = 0;
+
+    void sendRecord(JKBMSSession& session, unsigned char type) {
+        unsigned char record[RECORD_LENGTH] = {};
+        memcpy(record, START_OF_RECORD, sizeof(START_OF_RECORD));
+        record[4] = type;
+        record[RECORD_LENGTH - 1] = crc8(record, RECORD_LENGTH - 1) ^ (corruptRecords ? 0xFF : 0x00);
+
+        // Split the way a BLE link with a small MTU would
+        for (size_t offset = 0; offset < RECORD_LENGTH; offset += 128) {
+            size_t length = RECORD_LENGTH - offset < 128 ? RECORD_LENGTH - offset : 128;
+            session.handleNotification(record + offset, length);
+        }
+    }
+};
+
+static NullPrint quiet;
+
+// Advances the clock a step at a time until the session ends or the time is up
+static void run(JKBMSSession& session, FakeTransport& transport, unsigned long duration) {
+    unsigned long end = now + duration;
+    while (session.isActive() && (long) (now - end) < 0) {
+        now += 10;
+        transport.deliver(session);
+        session.poll();
+    }
+}
+
+void setUp() {
+    now = 1000;
+}
+
+void tearDown() {}
+
+void test_session_latency() {
+    JKBMSNotificationBuffer buffer;
+    FakeTransport transport;
+    JKBMSSession session(buffer, transport, fakeClock, quiet);
+
+    session.begin();
+    now += 200;
+    session.onConnected();
+    now += 50;
+    session.onSubscribed();
+    run(session, transport, 5000);
+
+    const JKBMSSessionTimings& timings = session.getTimings();
+    TEST_ASSERT_EQUAL(SESSION_COMPLETE, transport.ended);
+    TEST_ASSERT_EQUAL(2, transport.requests);
+    TEST_ASSERT_EQUAL_UINT32(250, timings.subscribed - timings.started);
+    TEST_ASSERT_EQUAL_UINT32(280, timings.batteryInfo - timings.started);
+    TEST_ASSERT_EQUAL_UINT32(310, timings.cellInfo - timings.started);
+}
+
+void test_restored_battery_info_skips_a_request() {
+    JKBMSNotificationBuffer buffer;
+    FakeTransport transport;
+    JKBMSSession session(buffer, transport, fakeClock, quiet);
+
+    unsigned char record[RECORD_LENGTH] = {};
+    memcpy(record, START_OF_RECORD, sizeof(START_OF_RECORD));
+    record[4] = 0x03;
+    record[RECORD_LENGTH - 1] = crc8(record, RECORD_LENGTH - 1);
+
+    session.begin();
+    TEST_ASSERT_TRUE(session.onSubscribed(record));
+    run(session, transport, 5000);
+
+    TEST_ASSERT_EQUAL(SESSION_COMPLETE, transport.ended);
+    TEST_ASSERT_EQUAL(1, transport.requests);
+    TEST_ASSERT_EQUAL(GET_SETTINGS_INFO[4], transport.lastCommand);
+}
+
+void test_silent_bms_times_out_after_retries() {
+    JKBMSNotificationBuffer buffer;
+    FakeTransport transport;
+    transport.respond = false;
+    JKBMSSession session(buffer, transport, fakeClock, quiet);
+
+    session.begin();
+    session.onConnected();
+    session.onSubscribed();
+    run(session, transport, ACTIVITY_TIMEOUT * 2);
+
+    TEST_ASSERT_EQUAL(SESSION_TIMED_OUT, transport.ended);
+    TEST_ASSERT_EQUAL(FAILURE_TIMEOUT, session.getFailure());
+    TEST_ASSERT_EQUAL(1 + MAX_REQUEST_RETRIES, transport.requests);
+}
+
+void test_bad_records_do_not_hold_off_the_timeout() {
+    JKBMSNotificationBuffer buffer;
+    FakeTransport transport;
+    transport.corruptRecords = true;
+    JKBMSSession session(buffer, transport, fakeClock, quiet);
+
+    session.begin();
+    session.onConnected();
+    session.onSubscribed();
+    run(session, transport, ACTIVITY_TIMEOUT * 2);
+
+    TEST_ASSERT_EQUAL(SESSION_TIMED_OUT, transport.ended);
+    TEST_ASSERT_EQUAL(1 + MAX_REQUEST_RETRIES, transport.requests);
+}
+
+void test_failed_send_is_retried() {
+    JKBMSNotificationBuffer buffer;
+    FakeTransport transport;
+    transport.failSends = 1;
+    JKBMSSession session(buffer, transport, fakeClock, quiet);
+
+    session.begin();
+    session.onSubscribed();
+    run(session, transport, 5000);
+
+    // Retried on the next poll instead of after REQUEST_TIMEOUT
+    TEST_ASSERT_EQUAL(SESSION_COMPLETE, transport.ended);
+    TEST_ASSERT_EQUAL(2, transport.requests);
+    TEST_ASSERT_EQUAL_UINT32(70, session.getTimings().cellInfo - session.getTimings().started);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_session_latency);
+    RUN_TEST(test_restored_battery_info_skips_a_request);
+    RUN_TEST(test_silent_bms_times_out_after_retries);
+    RUN_TEST(test_bad_records_do_not_hold_off_the_timeout);
+    RUN_TEST(test_failed_send_is_retried);
+    return UNITY_END();
+}
\ No newline at end of file